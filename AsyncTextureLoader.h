@@ -0,0 +1,265 @@
+//
+// Decodes images on worker threads and uploads them on the GL thread
+// a few at a time.
+//
+// load( ) queues a file to be decoded into a Texture that already
+// exists, usually one made with Texture's placeholder constructor, and
+// returns a future that becomes true once the image is in the texture
+// and false if it could not be loaded. The other load( ) hands the
+// image to a Receiver instead, which is how TextureArray fills its
+// layers. Up to MAX_WORKERS threads take files from the queue and
+// decode them with Texture::decode( ), which is safe on several
+// threads at once, so the time to load many images is about that of
+// the slowest rather than the sum. Decoded images are pushed onto a
+// lock free list, which the GL thread empties in update( ), once a
+// frame. update( ) uploads images until the frame's budget of bytes is
+// spent, always at least one, and keeps the rest for later frames, so
+// a burst of finished images does not stall one frame. finish( )
+// uploads everything queued and waits for what is still being decoded.
+//
+// The loader holds only weak references to textures and receivers:
+// one dropped before its image arrives is not kept alive, and never
+// destroyed on a worker thread, where there is no context.
+//
+//
+
+#include <cstdio>
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include "Texture.h"
+
+#ifndef _ASYNC_TEXTURE_LOADER_H_
+#define _ASYNC_TEXTURE_LOADER_H_
+
+class AsyncTextureLoader{
+public:
+  static const unsigned int MAX_WORKERS = 8;
+  // Bytes uploaded a frame, one 1024x1024 RGBA image
+  static const size_t UPLOAD_BUDGET = 4 << 20;
+
+  AsyncTextureLoader( ) : _stop(false), _decoded(NULL), _outstanding(0), _uploaded(0){ }
+
+  ~AsyncTextureLoader( ){
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all( );
+    for(size_t i = 0; i < _workers.size( ); i++){
+      _workers[i].join( );
+    }
+    for(size_t i = 0; i < _requests.size( ); i++){
+      discard(_requests[i]);
+    }
+    takeDecoded( );
+    for(size_t i = 0; i < _ready.size( ); i++){
+      discard(_ready[i]);
+    }
+  }
+
+  // Takes decoded images on the GL thread, for destinations other than
+  // a whole Texture, such as the layers of a TextureArray. pixels is
+  // NULL for an image that could not be loaded.
+  class Receiver{
+  public:
+    virtual ~Receiver( ){ }
+    virtual void receive(int image, int width, int height, const unsigned char* pixels) = 0;
+  };
+
+  std::shared_future<bool> load(const std::shared_ptr<Texture>& texture, const std::string& path){
+    Job* job = new Job( );
+    job->texture = texture;
+    job->path = path;
+    return queue(job);
+  }
+
+  // Hands the image to receiver, tagged with image, if receiver is
+  // still held when it arrives
+  std::shared_future<bool> load(const std::shared_ptr<Receiver>& receiver, int image, const std::string& path){
+    Job* job = new Job( );
+    job->receiver = receiver;
+    job->image = image;
+    job->path = path;
+    return queue(job);
+  }
+
+  // Uploads decoded images until budget bytes have gone up; call once a
+  // frame with the context current. Returns how many were uploaded.
+  unsigned int update(size_t budget = UPLOAD_BUDGET){
+    takeDecoded( );
+    unsigned int n = 0;
+    size_t bytes = 0;
+    while(!_ready.empty( ) && (n == 0 || bytes < budget)){
+      Job* job = _ready.front( );
+      _ready.pop_front( );
+      bytes += size_t(job->width) * job->height * 4;
+      upload(job);
+      n++;
+    }
+    return n;
+  }
+
+  // Blocks until every image queued so far is in its texture
+  void finish( ){
+    while(_outstanding > 0){
+      update(size_t(-1));
+      if(_outstanding > 0){
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished.wait_for(lock, std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  // Images queued and not yet uploaded
+  unsigned int pending( ) const{
+    return _outstanding;
+  }
+
+  // Images uploaded since construction
+  unsigned int uploaded( ) const{
+    return _uploaded;
+  }
+
+private:
+  // For either a Texture or a Receiver
+  struct Job{
+    std::weak_ptr<Texture> texture;
+    std::weak_ptr<Receiver> receiver;
+    int image;
+    std::string path;
+    std::promise<bool> done;
+    int width;
+    int height;
+    unsigned char* pixels;
+    // Link in the list of decoded jobs
+    Job* next;
+
+    Job( ) : image(0), width(0), height(0), pixels(NULL), next(NULL){ }
+
+    bool expired( ) const{
+      return texture.expired( ) && receiver.expired( );
+    }
+  };
+
+  // Shared with the workers under _mutex
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _finished;
+  std::deque<Job*> _requests;
+  bool _stop;
+
+  // Pushed by the workers, taken whole by the GL thread
+  std::atomic<Job*> _decoded;
+  std::atomic<unsigned int> _outstanding;
+
+  // Only touched by the GL thread
+  std::deque<Job*> _ready;
+  unsigned int _uploaded;
+
+  std::shared_future<bool> queue(Job* job){
+    std::shared_future<bool> done = job->done.get_future( ).share( );
+    _outstanding++;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if(_workers.empty( )){
+        unsigned int n = std::thread::hardware_concurrency( );
+        if(n == 0){
+          n = 1;
+        }else if(n > MAX_WORKERS){
+          n = MAX_WORKERS;
+        }
+        for(unsigned int i = 0; i < n; i++){
+          _workers.push_back(std::thread(&AsyncTextureLoader::work, this));
+        }
+      }
+      _requests.push_back(job);
+    }
+    _wake.notify_one( );
+    return done;
+  }
+
+  void work( ){
+    for(;;){
+      Job* job;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while(_requests.empty( ) && !_stop){
+          _wake.wait(lock);
+        }
+        if(_stop){
+          return;
+        }
+        job = _requests.front( );
+        _requests.pop_front( );
+      }
+      // Not worth decoding for a texture already dropped
+      if(!job->expired( )){
+        const char* reason;
+        job->pixels = Texture::decode(job->path.c_str( ), job->width, job->height, reason);
+        if(!job->pixels){
+          fprintf(stderr, "AsyncTextureLoader: can't load %s: %s\n", job->path.c_str( ), reason);
+        }
+      }
+      job->next = _decoded.load( );
+      while(!_decoded.compare_exchange_weak(job->next, job)){
+      }
+      _finished.notify_all( );
+    }
+  }
+
+  // Moves every decoded job to _ready in the order they were pushed.
+  // Taking the whole list at once means the only contention is with
+  // pushes, which simply retry.
+  void takeDecoded( ){
+    Job* list = _decoded.exchange(NULL);
+    Job* reversed = NULL;
+    while(list){
+      Job* next = list->next;
+      list->next = reversed;
+      reversed = list;
+      list = next;
+    }
+    for(; reversed; reversed = reversed->next){
+      _ready.push_back(reversed);
+    }
+  }
+
+  void upload(Job* job){
+    std::shared_ptr<Texture> texture = job->texture.lock( );
+    std::shared_ptr<Receiver> receiver = job->receiver.lock( );
+    bool loaded = (texture || receiver) && job->pixels;
+    if(texture && job->pixels){
+      texture->upload(job->width, job->height, job->pixels);
+    }else if(receiver){
+      receiver->receive(job->image, job->width, job->height, job->pixels);
+    }
+    if(loaded){
+      _uploaded++;
+    }
+    stbi_image_free(job->pixels);
+    job->done.set_value(loaded);
+    delete job;
+    _outstanding--;
+  }
+
+  void discard(Job* job){
+    stbi_image_free(job->pixels);
+    job->done.set_value(false);
+    delete job;
+  }
+
+  AsyncTextureLoader(const AsyncTextureLoader&);
+  AsyncTextureLoader& operator=(const AsyncTextureLoader&);
+};
+
+#endif
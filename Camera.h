@@ -17,6 +17,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "utilities.h"
+#include "Frustum.h"
 
 #ifndef _CAMERA_H_
 #define _CAMERA_H_
@@ -24,6 +25,16 @@
 class Camera{
 private:
   float _rotationDelta;
+  // The view and projection matrices are kept until the fields they
+  // are made from change; see viewMatrix( ) and projectionMatrix( ).
+  glm::mat4 _view;
+  glm::vec3 _viewEye;
+  glm::vec3 _viewLookAt;
+  glm::vec3 _viewUp;
+  bool _viewValid;
+  glm::mat4 _projection;
+  glm::vec4 _projectionParameters;
+  bool _projectionValid;
 
 public:
   glm::vec3 eyePosition;
@@ -35,11 +46,11 @@ public:
   float far;
 
 
-  Camera(glm::vec3 position, glm::vec3 up, glm::vec3 la, float fieldOfViewInY, float n, float f):eyePosition(position), upVector(up), lookAt(la), fovy(fieldOfViewInY), near(n), far(f){
+  Camera(glm::vec3 position, glm::vec3 up, glm::vec3 la, float fieldOfViewInY, float n, float f):_viewValid(false), _projectionValid(false), eyePosition(position), upVector(up), lookAt(la), fovy(fieldOfViewInY), near(n), far(f){
     _rotationDelta = deg2rad(1.0);
   }
 
-  Camera( ){ }
+  Camera( ) : _viewValid(false), _projectionValid(false){ }
   ~Camera( ){ }
 
   void draw( ){
@@ -104,6 +115,17 @@ public:
     return halfHeightFar( ) * windowAspectRatio;
   }
 
+  // Radius in pixels of the image of a sphere of the given radius at
+  // the given distance along the view direction, for a viewport
+  // viewportHeight pixels high.
+  float projectedRadius(float radius, float distance, int viewportHeight){
+    if(distance <= near){
+      return float(viewportHeight);
+    }
+    float fovy_rads = deg2rad(fovy);
+    return radius * 0.5 * viewportHeight / (distance * tan(fovy_rads / 2.0));
+  }
+
   void drawViewFrustumX(float windowAspectRatio){
 
   }
@@ -269,12 +291,41 @@ public:
     eyePosition = m * eyePosition;
   }
 
+  // Rebuilt only when the eye position, look at point or up vector
+  // changed since the last call
+  const glm::mat4& viewMatrix( ){
+    if(!_viewValid || eyePosition != _viewEye || lookAt != _viewLookAt || upVector != _viewUp){
+      _view = glm::lookAt(eyePosition, lookAt, upVector);
+      _viewEye = eyePosition;
+      _viewLookAt = lookAt;
+      _viewUp = upVector;
+      _viewValid = true;
+    }
+    return _view;
+  }
+
+  // Rebuilt only when fovy, near, far or the aspect ratio changed
+  const glm::mat4& projectionMatrix(float windowAspectRatio){
+    glm::vec4 parameters(fovy, windowAspectRatio, near, far);
+    if(!_projectionValid || parameters != _projectionParameters){
+      _projection = glm::perspective(deg2rad(fovy), windowAspectRatio, near, far);
+      _projectionParameters = parameters;
+      _projectionValid = true;
+    }
+    return _projection;
+  }
+
   void perspectiveMatrix(glm::mat4& m, float windowAspectRatio){
-    m = glm::perspective(deg2rad(fovy), windowAspectRatio, near, far);
+    m = projectionMatrix(windowAspectRatio);
   }
 
   void lookAtMatrix(glm::mat4& m){
-    m = glm::lookAt(eyePosition, lookAt, upVector);
+    m = viewMatrix( );
+  }
+
+  // The world space view frustum, for culling
+  void frustum(Frustum& f, float windowAspectRatio){
+    f.extract(projectionMatrix(windowAspectRatio) * viewMatrix( ));
   }
 
   void debug( ){
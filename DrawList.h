@@ -0,0 +1,185 @@
+//
+// A per-frame list of draws ordered by a 64-bit sort key.
+//
+// Each draw is a key plus a payload the caller uses to find the
+// object again. From the most significant bit down the key holds
+//
+//   layer     4 bits  opaque, transparent, overlay
+//   program   8 bits  index of the shader program
+//   texture   8 bits  index of the texture
+//   mesh      8 bits  index of the mesh
+//   material 12 bits  index of the material
+//   depth    24 bits  view space distance, quantized
+//
+// so sorting the keys groups draws by the most expensive state
+// first and, among draws that share all of it, orders opaque ones
+// front to back for early depth rejection. Transparent draws store
+// the depth inverted so they sort back to front. The indices are
+// the caller's small numbers, not GL names.
+//
+// The keys are sorted with a least significant digit radix sort,
+// eight bits per pass; digits every key has in common are skipped,
+// which for a typical frame leaves only the depth and material
+// passes.
+//
+//
+
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#ifndef _DRAW_LIST_H_
+#define _DRAW_LIST_H_
+
+struct DrawItem{
+  uint64_t key;
+  uint32_t payload;
+};
+
+class DrawList{
+public:
+  typedef enum{
+    LAYER_OPAQUE = 0,
+    LAYER_TRANSPARENT = 1,
+    LAYER_OVERLAY = 2
+  }layer_t;
+
+  static const int LAYER_BITS = 4;
+  static const int PROGRAM_BITS = 8;
+  static const int TEXTURE_BITS = 8;
+  static const int MESH_BITS = 8;
+  static const int MATERIAL_BITS = 12;
+  static const int DEPTH_BITS = 24;
+
+  static const int DEPTH_SHIFT = 0;
+  static const int MATERIAL_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+  static const int MESH_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+  static const int TEXTURE_SHIFT = MESH_SHIFT + MESH_BITS;
+  static const int PROGRAM_SHIFT = TEXTURE_SHIFT + TEXTURE_BITS;
+  static const int LAYER_SHIFT = PROGRAM_SHIFT + PROGRAM_BITS;
+
+  // depth is the distance along the view direction; it is clamped to
+  // [near, far] and quantized to DEPTH_BITS.
+  static uint64_t makeKey(layer_t layer, unsigned int program, unsigned int texture,
+                          unsigned int mesh, unsigned int material,
+                          float depth, float near, float far){
+    const uint32_t maxDepth = (1u << DEPTH_BITS) - 1;
+    float t = (depth - near) / (far - near);
+    t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+    uint32_t d = uint32_t(t * maxDepth);
+    if(layer == LAYER_TRANSPARENT){
+      d = maxDepth - d;
+    }
+    return field(layer, LAYER_BITS, LAYER_SHIFT) |
+           field(program, PROGRAM_BITS, PROGRAM_SHIFT) |
+           field(texture, TEXTURE_BITS, TEXTURE_SHIFT) |
+           field(mesh, MESH_BITS, MESH_SHIFT) |
+           field(material, MATERIAL_BITS, MATERIAL_SHIFT) |
+           field(d, DEPTH_BITS, DEPTH_SHIFT);
+  }
+
+  static unsigned int layer(uint64_t key){
+    return extract(key, LAYER_BITS, LAYER_SHIFT);
+  }
+
+  static unsigned int program(uint64_t key){
+    return extract(key, PROGRAM_BITS, PROGRAM_SHIFT);
+  }
+
+  static unsigned int texture(uint64_t key){
+    return extract(key, TEXTURE_BITS, TEXTURE_SHIFT);
+  }
+
+  static unsigned int mesh(uint64_t key){
+    return extract(key, MESH_BITS, MESH_SHIFT);
+  }
+
+  static unsigned int material(uint64_t key){
+    return extract(key, MATERIAL_BITS, MATERIAL_SHIFT);
+  }
+
+  // True when two draws share layer, program, texture and mesh and so
+  // can be drawn as one instanced batch.
+  static bool sameBatch(uint64_t a, uint64_t b){
+    return (a >> MESH_SHIFT) == (b >> MESH_SHIFT);
+  }
+
+  void clear( ){
+    _items.clear( );
+  }
+
+  void add(uint64_t key, uint32_t payload){
+    DrawItem item;
+    item.key = key;
+    item.payload = payload;
+    _items.push_back(item);
+  }
+
+  size_t size( ) const{
+    return _items.size( );
+  }
+
+  const DrawItem& operator [](size_t i) const{
+    return _items[i];
+  }
+
+  void sort( ){
+    size_t n = _items.size( );
+    if(n < 2){
+      return;
+    }
+    // One pass over the keys builds the histograms of every digit.
+    memset(_counts, 0, sizeof(_counts));
+    for(size_t i = 0; i < n; i++){
+      uint64_t key = _items[i].key;
+      for(int digit = 0; digit < DIGITS; digit++){
+        _counts[digit][(key >> (digit * RADIX_BITS)) & RADIX_MASK]++;
+      }
+    }
+    _scratch.resize(n);
+    DrawItem* from = &_items[0];
+    DrawItem* to = &_scratch[0];
+    for(int digit = 0; digit < DIGITS; digit++){
+      size_t* count = _counts[digit];
+      // Every key has the same digit; this pass would not move anything.
+      if(count[(from[0].key >> (digit * RADIX_BITS)) & RADIX_MASK] == n){
+        continue;
+      }
+      size_t offset = 0;
+      for(int bucket = 0; bucket < RADIX; bucket++){
+        size_t c = count[bucket];
+        count[bucket] = offset;
+        offset += c;
+      }
+      for(size_t i = 0; i < n; i++){
+        to[count[(from[i].key >> (digit * RADIX_BITS)) & RADIX_MASK]++] = from[i];
+      }
+      DrawItem* t = from;
+      from = to;
+      to = t;
+    }
+    if(from != &_items[0]){
+      _items.swap(_scratch);
+    }
+  }
+
+private:
+  static const int RADIX_BITS = 8;
+  static const int RADIX = 1 << RADIX_BITS;
+  static const uint64_t RADIX_MASK = RADIX - 1;
+  static const int DIGITS = 64 / RADIX_BITS;
+
+  std::vector<DrawItem> _items;
+  std::vector<DrawItem> _scratch;
+  size_t _counts[DIGITS][RADIX];
+
+  static uint64_t field(uint32_t value, int bits, int shift){
+    return (uint64_t(value) & ((uint64_t(1) << bits) - 1)) << shift;
+  }
+
+  static unsigned int extract(uint64_t key, int bits, int shift){
+    return (unsigned int)((key >> shift) & ((uint64_t(1) << bits) - 1));
+  }
+};
+
+#endif
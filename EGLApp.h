@@ -0,0 +1,343 @@
+//
+// A headless stand in for GLFWApp that draws into a framebuffer
+// object through an EGL context, for timing on machines without a
+// display.
+//
+// It has the same begin( ), render( ) and end( ) contract and the same
+// public interface as GLFWApp, so an application chooses between the
+// two at compile time. The context is made on the Mesa surfaceless
+// platform when EGL offers it and otherwise on the default display
+// with a 1x1 pbuffer that is never drawn to. Everything is drawn into
+// a framebuffer object of the requested window size with a depth
+// buffer, bound for the whole run, so glReadPixels reads what was
+// drawn. There is no window, so there is no vsync and no input:
+// swap( ) only flushes, the pacer's swap interval is ignored and no
+// key is ever pressed. The loop runs until the application calls
+// windowShouldClose( ).
+//
+// With Mesa, LIBGL_ALWAYS_SOFTWARE=1 selects llvmpipe.
+//
+//
+
+#include <array>
+#include <tuple>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <FreeImage.h>
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "FramePacer.h"
+
+#ifndef _EGL_APP_H_
+#define _EGL_APP_H_
+
+class EGLApp{
+ public:
+
+  typedef enum{
+    CORE,
+    COMPATIBILITY
+  }profile_t;
+
+  typedef enum{
+    VSYNC,
+    ASYNC,
+    TEARING
+  }syncmode_t;
+
+  typedef enum{
+    MOUSE_BUTTON_NONE = 0,
+    MOUSE_BUTTON_LEFT = 1,
+    MOUSE_BUTTON_RIGHT = 2,
+    MOUSE_BUTTON_MIDDLE = 4
+  }mouseButton_t;
+
+  EGLApp(int argc, char* argv[], const char* windowTitle,
+         int windowSize_X, int windowSize_Y,
+         int major = 2, int minor = 1,
+         std::tuple<int, int> const & position = std::make_tuple(100, 100),
+         profile_t profile = COMPATIBILITY) :
+    _display(EGL_NO_DISPLAY),
+    _surface(EGL_NO_SURFACE),
+    _context(EGL_NO_CONTEXT),
+    _framebuffer(0),
+    _width(windowSize_X),
+    _height(windowSize_Y),
+    _major(major),
+    _minor(minor),
+    _profile(profile),
+    _shouldClose(false){
+    memset(&_keyPressed[0], 0, sizeof(_keyPressed));
+    _renderbuffers[0] = _renderbuffers[1] = 0;
+    if(_profile == CORE && _myGLVersion( ) < 320){
+      _profile = COMPATIBILITY;
+    }
+    if(!_openDisplay( )){
+      fprintf(stderr, "EGLApp: no EGL display\n");
+      return;
+    }
+    _context = _createContext( );
+    if(_context == EGL_NO_CONTEXT && _profile == CORE){
+      fprintf(stderr, "No OpenGL %d.%d core profile context; falling back to 2.1 compatibility\n", _major, _minor);
+      _major = 2;
+      _minor = 1;
+      _profile = COMPATIBILITY;
+      _context = _createContext( );
+    }
+    if(_context == EGL_NO_CONTEXT){
+      fprintf(stderr, "EGLApp: can't create an OpenGL %d.%d context (0x%x)\n", _major, _minor, eglGetError( ));
+      return;
+    }
+    if(!eglMakeCurrent(_display, _surface, _surface, _context)){
+      fprintf(stderr, "EGLApp: can't make the context current (0x%x)\n", eglGetError( ));
+      eglDestroyContext(_display, _context);
+      _context = EGL_NO_CONTEXT;
+      return;
+    }
+    glewExperimental = GL_TRUE;
+    // A GLEW built for GLX also looks for GLX extensions and reports
+    // that there is no X display; the GL entry points are loaded by
+    // then.
+    glewInit( );
+    while(glGetError( ) != GL_NO_ERROR){
+    }
+    if(!_createFramebuffer( )){
+      fprintf(stderr, "EGLApp: can't create a %dx%d framebuffer\n", _width, _height);
+      eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+      eglDestroyContext(_display, _context);
+      _context = EGL_NO_CONTEXT;
+      return;
+    }
+    sync(ASYNC);
+    FreeImage_Initialise( );
+    printf("Rendering headless into a %dx%d framebuffer on %s.\n", _width, _height, (const char*)glGetString(GL_RENDERER));
+  }
+
+  virtual ~EGLApp( ){
+    if(_context != EGL_NO_CONTEXT){
+      _pacer.release( );
+      glDeleteFramebuffers(1, &_framebuffer);
+      glDeleteRenderbuffers(2, _renderbuffers);
+      eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+      eglDestroyContext(_display, _context);
+      FreeImage_DeInitialise( );
+    }
+    if(_surface != EGL_NO_SURFACE){
+      eglDestroySurface(_display, _surface);
+    }
+    if(_display != EGL_NO_DISPLAY){
+      eglTerminate(_display);
+    }
+  }
+
+  // Nothing waits for a refresh, so VSYNC and TEARING only change how
+  // lateness is judged
+  void sync(syncmode_t const & sync){
+    switch(sync){
+    case ASYNC:
+      _pacer.setMode(FramePacer::UNCAPPED, 0.0);
+      break;
+    case VSYNC:
+      _pacer.setMode(FramePacer::VSYNC);
+      break;
+    case TEARING:
+      _pacer.setMode(FramePacer::ADAPTIVE);
+      break;
+    }
+  }
+
+  FramePacer& pacer( ){
+    return _pacer;
+  }
+
+  void swap( ){
+    glFlush( );
+  }
+
+  virtual bool begin( ) = 0;
+  virtual bool render( ) = 0;
+  virtual bool end( ) = 0;
+
+  virtual void poll( ){
+  }
+
+  void windowShouldClose( ){
+    _shouldClose = true;
+  }
+
+  int operator( )( ){
+    int rv = EXIT_FAILURE;
+    if(_context != EGL_NO_CONTEXT){
+      rv = this->begin() ? EXIT_SUCCESS : EXIT_FAILURE;
+      while(rv == EXIT_SUCCESS){
+        _pacer.beginFrame( );
+        rv = this->render() ? EXIT_SUCCESS : EXIT_FAILURE;
+        if(!this->checkGLError("Render")){
+          rv = EXIT_FAILURE;
+        }
+        _pacer.endFrame( );
+        poll( );
+        if(_shouldClose){
+          break;
+        }
+        _pacer.wait( );
+        swap( );
+        _pacer.presented( );
+      }
+      if(!this->end()){
+        rv = EXIT_FAILURE;
+      }
+    }
+    return rv;
+  }
+
+  std::tuple<int, int> windowSize( ) const{
+    return std::make_tuple(_width, _height);
+  }
+
+  int windowWidth( ) const{
+    return _width;
+  }
+
+  int windowHeight( ) const{
+    return _height;
+  }
+
+  profile_t profile( ) const{
+    return _profile;
+  }
+
+  bool isCoreProfile( ) const{
+    return _profile == CORE;
+  }
+
+  bool isKeyPressed(int key) const{
+    return _keyPressed[key];
+  }
+
+  void keyUp(int key){
+    _keyPressed[key] = false;
+  }
+
+ protected:
+  bool checkGLError(const char *msg){
+    bool ret = true;
+    GLenum err = glGetError( );
+    while(err != GL_NO_ERROR){
+      ret = false;
+      fprintf(stderr, "GL ERROR(%s): 0x%04x\n", msg, err);
+      err = glGetError( );
+    }
+    return( ret );
+  }
+
+  std::tuple<int, int> mouseCurrentPosition( ){
+    return std::make_tuple(_width / 2, _height / 2);
+  }
+
+  int mouseButtonFlags( ){
+    return MOUSE_BUTTON_NONE;
+  }
+
+ private:
+  EGLDisplay _display;
+  EGLSurface _surface;
+  EGLContext _context;
+  EGLConfig _config;
+  GLuint _framebuffer;
+  // Color and depth
+  GLuint _renderbuffers[2];
+  int _width;
+  int _height;
+  int _major;
+  int _minor;
+  profile_t _profile;
+  bool _shouldClose;
+  std::array<bool, 512> _keyPressed;
+  FramePacer _pacer;
+
+  bool _openDisplay( ){
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    bool surfaceless = extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay;
+    if(surfaceless){
+      _display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if(_display == EGL_NO_DISPLAY || !eglInitialize(_display, NULL, NULL)){
+      surfaceless = false;
+      _display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+      if(_display == EGL_NO_DISPLAY || !eglInitialize(_display, NULL, NULL)){
+        _display = EGL_NO_DISPLAY;
+        return false;
+      }
+    }
+    if(!eglBindAPI(EGL_OPENGL_API)){
+      return false;
+    }
+    const EGLint configAttributes[] = {
+      EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE
+    };
+    EGLint count = 0;
+    if(!eglChooseConfig(_display, configAttributes, &_config, 1, &count) || count == 0){
+      return false;
+    }
+    if(!surfaceless){
+      const EGLint pbufferAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+      _surface = eglCreatePbufferSurface(_display, _config, pbufferAttributes);
+      if(_surface == EGL_NO_SURFACE){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  EGLContext _createContext( ){
+    const EGLint attributes[] = {
+      EGL_CONTEXT_MAJOR_VERSION, _major,
+      EGL_CONTEXT_MINOR_VERSION, _minor,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK,
+      _profile == CORE ? EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT : EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+      EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, _profile == CORE ? EGL_TRUE : EGL_FALSE,
+      EGL_NONE
+    };
+    return eglCreateContext(_display, _config, EGL_NO_CONTEXT, attributes);
+  }
+
+  bool _createFramebuffer( ){
+    if(!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object){
+      return false;
+    }
+    glGenRenderbuffers(2, _renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _width, _height);
+    glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _width, _height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _renderbuffers[1]);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, _width, _height);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  }
+
+  int _myGLVersion( ) const{
+    return _major * 100 + _minor * 10;
+  }
+
+  EGLApp(const EGLApp&);
+  EGLApp& operator=(const EGLApp&);
+};
+
+#endif
@@ -0,0 +1,159 @@
+//
+// Notices when files are rewritten, so shaders can be reloaded
+// while the program runs.
+//
+// On Linux the watcher holds a non-blocking inotify descriptor with
+// one watch per directory. Editors commonly save by writing a new
+// file and renaming it over the old one, which a watch on the file
+// itself would lose, so the directory is watched for files closed
+// after writing or moved in, and only the names asked for are
+// reported. poll( ) never blocks and is meant to be called once a
+// frame. Elsewhere supported( ) is false and poll( ) reports nothing.
+//
+//
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#ifndef _FILE_WATCHER_H_
+#define _FILE_WATCHER_H_
+
+class FileWatcher{
+public:
+  FileWatcher( ) : _fd(-1){
+#ifdef __linux__
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(_fd < 0){
+      fprintf(stderr, "FileWatcher: inotify is unavailable\n");
+    }
+#endif
+  }
+
+  ~FileWatcher( ){
+#ifdef __linux__
+    if(_fd >= 0){
+      close(_fd);
+    }
+#endif
+  }
+
+  bool supported( ) const{
+    return _fd >= 0;
+  }
+
+  // Reports path from poll( ) whenever it is rewritten.
+  bool watch(const std::string& path){
+    if(_fd < 0){
+      return false;
+    }
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    Directory* d = find(directory);
+    if(!d){
+#ifdef __linux__
+      int wd = inotify_add_watch(_fd, directory.c_str( ), IN_CLOSE_WRITE | IN_MOVED_TO);
+      if(wd < 0){
+        fprintf(stderr, "FileWatcher: can't watch %s\n", directory.c_str( ));
+        return false;
+      }
+      Directory added;
+      added.wd = wd;
+      added.path = directory;
+      _directories.push_back(added);
+      d = &_directories.back( );
+#endif
+    }
+    for(size_t i = 0; i < d->files.size( ); i++){
+      if(d->files[i].name == name){
+        return true;
+      }
+    }
+    File file;
+    file.name = name;
+    file.path = path;
+    d->files.push_back(file);
+    return true;
+  }
+
+  // Appends every watched path rewritten since the last call, each
+  // once; returns how many were appended.
+  size_t poll(std::vector<std::string>& changed){
+    size_t before = changed.size( );
+#ifdef __linux__
+    if(_fd < 0){
+      return 0;
+    }
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for(;;){
+      ssize_t length = read(_fd, buffer, sizeof(buffer));
+      if(length <= 0){
+        break;
+      }
+      for(char* p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len){
+        const struct inotify_event* event = (const struct inotify_event*)p;
+        if(event->len == 0){
+          continue;
+        }
+        const File* file = find(event->wd, event->name);
+        if(file && std::find(changed.begin( ) + before, changed.end( ), file->path) == changed.end( )){
+          changed.push_back(file->path);
+        }
+      }
+    }
+#endif
+    return changed.size( ) - before;
+  }
+
+private:
+  struct File{
+    std::string name;
+    std::string path;
+  };
+
+  struct Directory{
+    int wd;
+    std::string path;
+    std::vector<File> files;
+  };
+
+  int _fd;
+  std::vector<Directory> _directories;
+
+  Directory* find(const std::string& path){
+    for(size_t i = 0; i < _directories.size( ); i++){
+      if(_directories[i].path == path){
+        return &_directories[i];
+      }
+    }
+    return NULL;
+  }
+
+  const File* find(int wd, const char* name) const{
+    for(size_t i = 0; i < _directories.size( ); i++){
+      if(_directories[i].wd != wd){
+        continue;
+      }
+      const std::vector<File>& files = _directories[i].files;
+      for(size_t j = 0; j < files.size( ); j++){
+        if(files[j].name == name){
+          return &files[j];
+        }
+      }
+    }
+    return NULL;
+  }
+
+  FileWatcher(const FileWatcher&);
+  FileWatcher& operator=(const FileWatcher&);
+};
+
+#endif
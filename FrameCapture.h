@@ -0,0 +1,445 @@
+//
+// Records rendered frames to PNG files or a Y4M video without
+// stalling on the read back.
+//
+// capture( ), called once a frame after drawing, starts a
+// glReadPixels of the back buffer into one of two pixel pack buffers
+// and maps the other, which was read into a frame earlier; by then
+// the copy has long finished, so mapping does not wait for the GPU.
+// With ARB_sync a fence after each read tells whether it has; a read
+// still in flight is waited for and counted. The mapped pixels are
+// copied out and queued for a worker thread, which writes each frame
+// as a PNG through FreeImage or appends it to a YUV4MPEG2 file as
+// 4:2:0 planes. If the worker falls more than MAX_QUEUED frames
+// behind, further frames are dropped and counted rather than let the
+// queue grow or the render loop block.
+//
+//
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include <FreeImage.h>
+#include <GL/glew.h>
+
+#include "GLStateCache.h"
+
+#ifndef _FRAME_CAPTURE_H_
+#define _FRAME_CAPTURE_H_
+
+class FrameCapture{
+public:
+  enum Format{
+    PNG,
+    Y4M
+  };
+
+  static const int BUFFERS = 2;
+  static const size_t MAX_QUEUED = 8;
+
+  FrameCapture( ) : _format(PNG), _width(0), _height(0), _limit(0), _read(0),
+    _dropped(0), _stalls(0), _next(0), _active(false), _busy(false), _stop(false), _y4m(NULL){
+    for(int i = 0; i < BUFFERS; i++){
+      _buffers[i] = 0;
+      _fences[i] = 0;
+      _pending[i] = false;
+    }
+  }
+
+  ~FrameCapture( ){
+    stop( );
+    if(_worker.joinable( )){
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _wake.notify_all( );
+      _worker.join( );
+    }
+    if(_buffers[0]){
+      glDeleteBuffers(BUFFERS, _buffers);
+    }
+  }
+
+  // Pixel pack buffers are core in OpenGL 2.1
+  static bool supported( ){
+    return GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object;
+  }
+
+  // Captures frames of width by height pixels, at most frames of them
+  // or until stop( ) when frames is 0. A PNG capture writes path
+  // followed by the frame number and .png, or just path and .png for a
+  // single frame; a Y4M capture writes all frames to path, to be
+  // played at fps frames a second.
+  bool start(const std::string& path, Format format, int width, int height, unsigned int frames = 0, int fps = 60){
+    if(!supported( )){
+      fprintf(stderr, "FrameCapture: pixel buffer objects are unavailable\n");
+      return false;
+    }
+    stop( );
+    _path = path;
+    _format = format;
+    _width = width;
+    _height = height;
+    _limit = frames;
+    _read = 0;
+    _dropped = 0;
+    _stalls = 0;
+    _next = 0;
+    allocate( );
+    if(!_worker.joinable( )){
+      _worker = std::thread(&FrameCapture::work, this);
+    }
+    if(_format == Y4M){
+      Job* job = new Job( );
+      job->type = OPEN_Y4M;
+      job->path = path;
+      job->width = width;
+      job->height = height;
+      job->fps = fps;
+      enqueue(job);
+    }
+    _active = true;
+    return true;
+  }
+
+  bool active( ) const{
+    return _active;
+  }
+
+  // Reads the frame just drawn and hands over the one read last frame
+  void capture( ){
+    if(!_active){
+      return;
+    }
+    GLStateCache& state = GLStateCache::current( );
+    int i = _next;
+    int j = (i + 1) % BUFFERS;
+    if(_limit == 0 || _read < _limit){
+      if(_pending[i]){
+        collect(i);
+      }
+      state.bindBuffer(GL_PIXEL_PACK_BUFFER, _buffers[i]);
+      glReadPixels(0, 0, _width, _height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+      if(GLEW_ARB_sync){
+        _fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      }
+      _pending[i] = true;
+      _frameNumbers[i] = _read++;
+    }
+    if(_pending[j]){
+      collect(j);
+    }
+    state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _next = j;
+    if(_limit != 0 && _read == _limit && !_pending[0] && !_pending[1]){
+      finish( );
+    }
+  }
+
+  // Hands over any frames still in the pixel buffers and waits for
+  // the worker to write everything queued.
+  void stop( ){
+    if(!_active){
+      return;
+    }
+    for(int k = 1; k <= BUFFERS; k++){
+      int i = (_next + k) % BUFFERS;
+      if(_pending[i]){
+        collect(i);
+      }
+    }
+    GLStateCache::current( ).bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    finish( );
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(!_queue.empty( ) || _busy){
+      _idle.wait(lock);
+    }
+  }
+
+  // Frames read back since start( )
+  unsigned int read( ) const{
+    return _read;
+  }
+
+  unsigned int dropped( ) const{
+    return _dropped;
+  }
+
+  // Hand overs that had to wait for a read still in flight
+  unsigned int stalls( ) const{
+    return _stalls;
+  }
+
+private:
+  enum JobType{
+    OPEN_Y4M,
+    FRAME,
+    CLOSE_Y4M
+  };
+
+  struct Job{
+    JobType type;
+    Format format;
+    std::string path;
+    int fps;
+    // A PNG capture of a single frame names the file without a number
+    bool single;
+    int width;
+    int height;
+    unsigned int number;
+    std::vector<uint8_t> pixels;
+  };
+
+  Format _format;
+  std::string _path;
+  int _width;
+  int _height;
+  unsigned int _limit;
+  unsigned int _read;
+  unsigned int _dropped;
+  unsigned int _stalls;
+
+  GLuint _buffers[BUFFERS];
+  GLsync _fences[BUFFERS];
+  bool _pending[BUFFERS];
+  unsigned int _frameNumbers[BUFFERS];
+  int _next;
+  bool _active;
+
+  // Shared with the worker under _mutex
+  std::thread _worker;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _idle;
+  std::deque<Job*> _queue;
+  std::vector<Job*> _free;
+  bool _busy;
+  bool _stop;
+  // Only touched by the worker
+  FILE* _y4m;
+
+  void allocate( ){
+    if(!_buffers[0]){
+      glGenBuffers(BUFFERS, _buffers);
+    }
+    GLStateCache& state = GLStateCache::current( );
+    for(int i = 0; i < BUFFERS; i++){
+      state.bindBuffer(GL_PIXEL_PACK_BUFFER, _buffers[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(_width) * _height * 4, NULL, GL_STREAM_READ);
+      _pending[i] = false;
+    }
+    state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  // Copies buffer i out and queues it for the worker
+  void collect(int i){
+    _pending[i] = false;
+    if(_fences[i]){
+      if(glClientWaitSync(_fences[i], 0, 0) == GL_TIMEOUT_EXPIRED){
+        _stalls++;
+        glClientWaitSync(_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+      }
+      glDeleteSync(_fences[i]);
+      _fences[i] = 0;
+    }
+    Job* job = take( );
+    if(!job){
+      _dropped++;
+      return;
+    }
+    size_t bytes = size_t(_width) * _height * 4;
+    GLStateCache::current( ).bindBuffer(GL_PIXEL_PACK_BUFFER, _buffers[i]);
+    const void* mapped = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if(!mapped){
+      fprintf(stderr, "FrameCapture: can't map the pixel buffer\n");
+      release(job);
+      _dropped++;
+      return;
+    }
+    job->type = FRAME;
+    job->format = _format;
+    job->path = _path;
+    job->width = _width;
+    job->height = _height;
+    job->number = _frameNumbers[i];
+    job->single = _limit == 1;
+    job->pixels.resize(bytes);
+    memcpy(&job->pixels[0], mapped, bytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    enqueue(job);
+  }
+
+  void finish( ){
+    _active = false;
+    if(_format == Y4M){
+      Job* job = new Job( );
+      job->type = CLOSE_Y4M;
+      enqueue(job);
+    }
+    if(_dropped > 0){
+      fprintf(stderr, "FrameCapture: %u of %u frames dropped; the writer fell behind\n", _dropped, _read);
+    }
+  }
+
+  // A free job, or NULL when MAX_QUEUED frames are already waiting
+  Job* take( ){
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_queue.size( ) >= MAX_QUEUED){
+      return NULL;
+    }
+    if(_free.empty( )){
+      return new Job( );
+    }
+    Job* job = _free.back( );
+    _free.pop_back( );
+    return job;
+  }
+
+  void release(Job* job){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(job);
+  }
+
+  void enqueue(Job* job){
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queue.push_back(job);
+    }
+    _wake.notify_one( );
+  }
+
+  void work( ){
+    std::unique_lock<std::mutex> lock(_mutex);
+    for(;;){
+      while(_queue.empty( ) && !_stop){
+        _idle.notify_all( );
+        _wake.wait(lock);
+      }
+      if(_queue.empty( )){
+        break;
+      }
+      Job* job = _queue.front( );
+      _queue.pop_front( );
+      _busy = true;
+      lock.unlock( );
+      run(*job);
+      lock.lock( );
+      _busy = false;
+      if(job->type == FRAME){
+        _free.push_back(job);
+      }else{
+        delete job;
+      }
+    }
+    for(size_t i = 0; i < _free.size( ); i++){
+      delete _free[i];
+    }
+    _free.clear( );
+    _idle.notify_all( );
+  }
+
+  void run(Job& job){
+    switch(job.type){
+    case OPEN_Y4M:
+      _y4m = fopen(job.path.c_str( ), "wb");
+      if(!_y4m){
+        fprintf(stderr, "FrameCapture: can't write %s\n", job.path.c_str( ));
+        break;
+      }
+      fprintf(_y4m, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", job.width, job.height, job.fps);
+      break;
+    case CLOSE_Y4M:
+      if(_y4m){
+        fclose(_y4m);
+        _y4m = NULL;
+      }
+      break;
+    case FRAME:
+      if(job.format == PNG){
+        writePNG(job);
+      }else if(_y4m){
+        writeY4M(job);
+      }
+      break;
+    }
+  }
+
+  void writePNG(Job& job){
+    char number[16];
+    snprintf(number, sizeof(number), "%05u", job.number);
+    std::string path = job.path + (job.single ? "" : number) + ".png";
+    // The back buffer's alpha is whatever blending left there
+    for(size_t i = 3; i < job.pixels.size( ); i += 4){
+      job.pixels[i] = 255;
+    }
+    // Both GL and FreeImage store the bottom row first
+    FIBITMAP* bitmap = FreeImage_ConvertFromRawBits(&job.pixels[0], job.width, job.height, job.width * 4, 32,
+                                                    FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, false);
+    if(!bitmap || !FreeImage_Save(FIF_PNG, bitmap, path.c_str( ), PNG_DEFAULT)){
+      fprintf(stderr, "FrameCapture: can't write %s\n", path.c_str( ));
+    }
+    if(bitmap){
+      FreeImage_Unload(bitmap);
+    }
+  }
+
+  // Full range BT.601, as C420jpeg means, with each chroma sample the
+  // average of a 2x2 block; Y4M stores the top row first.
+  void writeY4M(const Job& job){
+    int w = job.width, h = job.height;
+    int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    _planes.resize(size_t(w) * h + 2 * size_t(cw) * ch);
+    uint8_t* y = &_planes[0];
+    uint8_t* u = y + size_t(w) * h;
+    uint8_t* v = u + size_t(cw) * ch;
+    const uint8_t* p = &job.pixels[0];
+    for(int row = 0; row < h; row++){
+      const uint8_t* bgra = p + size_t(h - 1 - row) * w * 4;
+      for(int x = 0; x < w; x++, bgra += 4){
+        y[size_t(row) * w + x] = uint8_t((29 * bgra[0] + 150 * bgra[1] + 77 * bgra[2] + 128) >> 8);
+      }
+    }
+    for(int row = 0; row < ch; row++){
+      for(int x = 0; x < cw; x++){
+        int b = 0, g = 0, r = 0, n = 0;
+        for(int dy = 0; dy < 2 && 2 * row + dy < h; dy++){
+          for(int dx = 0; dx < 2 && 2 * x + dx < w; dx++){
+            const uint8_t* bgra = p + (size_t(h - 1 - (2 * row + dy)) * w + 2 * x + dx) * 4;
+            b += bgra[0];
+            g += bgra[1];
+            r += bgra[2];
+            n++;
+          }
+        }
+        // 128 + (-43 r - 85 g + 128 b) / 256 and 128 + (128 r - 107 g - 21 b) / 256
+        int cb = (-43 * r - 85 * g + 128 * b) / n;
+        int cr = (128 * r - 107 * g - 21 * b) / n;
+        u[size_t(row) * cw + x] = uint8_t(clampByte(128 + ((cb + 128) >> 8)));
+        v[size_t(row) * cw + x] = uint8_t(clampByte(128 + ((cr + 128) >> 8)));
+      }
+    }
+    fputs("FRAME\n", _y4m);
+    if(fwrite(&_planes[0], 1, _planes.size( ), _y4m) != _planes.size( )){
+      fprintf(stderr, "FrameCapture: can't write %s\n", job.path.c_str( ));
+    }
+  }
+
+  static int clampByte(int x){
+    return x < 0 ? 0 : (x > 255 ? 255 : x);
+  }
+
+  // Only touched by the worker
+  std::vector<uint8_t> _planes;
+
+  FrameCapture(const FrameCapture&);
+  FrameCapture& operator=(const FrameCapture&);
+};
+
+#endif
@@ -0,0 +1,321 @@
+//
+// Paces frames and times them.
+//
+// The application loop calls beginFrame( ) before rendering,
+// endFrame( ) once the frame's commands are issued, wait( ) just
+// before swapping buffers and presented( ) just after. In between it
+// reads substeps( ), the number of fixed simulation steps this frame
+// should run.
+//
+// The mode decides what limits the frame rate:
+//
+//   UNCAPPED  swap interval 0; with a target rate, each frame is held
+//             back to it by sleeping until shortly before the deadline
+//             and spinning the rest of the way, since a sleep can
+//             overshoot by a good part of a millisecond
+//   VSYNC     swap interval 1
+//   ADAPTIVE  swap interval 1 while frames make the target rate, 0
+//             after frames keep missing it, so a late frame is shown
+//             at once instead of waiting for the next refresh; back to
+//             1 once frames are on time again
+//
+// Every frame three times are measured: the CPU time from beginFrame( )
+// to endFrame( ), the GPU time of the same commands with a
+// GL_TIME_ELAPSED query where there is one, read some frames later so
+// it never waits, and the time from one presented( ) to the next.
+//
+// Simulation runs in fixed steps of 1 / SIMULATION_RATE seconds, as
+// many a frame as real time has passed. A frame is late when its CPU
+// time or present interval overruns the target. What a late frame
+// gives up first is simulation: the next frame runs at most one step
+// and the rest of the time owed is dropped, so the simulation slows
+// down rather than each frame taking longer to catch up. Only in
+// ADAPTIVE mode, and only when frames stay late, does vsync go too.
+// In lockstep every frame runs exactly one step whatever the time,
+// so a benchmark does the same work every frame.
+//
+//
+
+#include <cstdio>
+#include <thread>
+#include <chrono>
+#include <GL/glew.h>
+
+#include "utilities.h"
+
+#ifndef _FRAME_PACER_H_
+#define _FRAME_PACER_H_
+
+class FramePacer{
+public:
+  typedef enum{
+    UNCAPPED,
+    VSYNC,
+    ADAPTIVE
+  }pacemode_t;
+
+  static const int SIMULATION_RATE = 60;
+  // At most this many steps catch up in one frame
+  static const unsigned int MAX_SUBSTEPS = 4;
+  // GPU timer results are read this many frames after they are issued
+  static const int QUERIES = 4;
+  // ADAPTIVE turns vsync off after this many late frames in a row and
+  // back on after ON_TIME_FRAMES frames on time
+  static const unsigned int LATE_FRAMES = 2;
+  static const unsigned int ON_TIME_FRAMES = 30;
+
+  FramePacer( ) : _mode(VSYNC), _targetRate(60.0), _lockstep(false), _interval(1), _frameStart(0.0),
+    _previousStart(0.0), _previousPresent(0.0), _deadline(0.0), _owed(0.0), _substeps(1), _late(false),
+    _lateRun(0), _onTimeRun(0), _query(0), _queriesInFlight(0), _timing(false){
+    for(int i = 0; i < QUERIES; i++){
+      _queries[i] = 0;
+    }
+    reset( );
+  }
+
+  // Queries are deleted here rather than in a destructor because the
+  // pacer may outlive its context.
+  void release( ){
+    if(_queries[0]){
+      glDeleteQueries(QUERIES, _queries);
+      _queries[0] = 0;
+    }
+  }
+
+  static bool supportsGPUTime( ){
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+  }
+
+  // A target rate of 0 leaves UNCAPPED unthrottled; ADAPTIVE judges
+  // lateness against the target, which should be the display's rate.
+  void setMode(pacemode_t mode, double targetRate = 60.0){
+    _mode = mode;
+    _targetRate = targetRate;
+    _interval = _mode == UNCAPPED ? 0 : 1;
+    _lateRun = 0;
+    _onTimeRun = 0;
+    _deadline = 0.0;
+  }
+
+  pacemode_t mode( ) const{
+    return _mode;
+  }
+
+  static const char* name(pacemode_t mode){
+    static const char* names[] = {"uncapped", "vsync", "adaptive"};
+    return names[mode];
+  }
+
+  void setLockstep(bool lockstep){
+    _lockstep = lockstep;
+  }
+
+  // The swap interval the next swap should use
+  int swapInterval( ) const{
+    return _interval;
+  }
+
+  void beginFrame( ){
+    double now = seconds( );
+    if(!_queries[0] && supportsGPUTime( )){
+      glGenQueries(QUERIES, _queries);
+    }
+    collectQueries( );
+    if(_queries[0]){
+      glBeginQuery(GL_TIME_ELAPSED, _queries[_query]);
+      _timing = true;
+    }
+    _substeps = 1;
+    if(!_lockstep && _previousStart > 0.0){
+      double step = 1.0 / SIMULATION_RATE;
+      _owed += now - _previousStart;
+      _substeps = (unsigned int)(_owed / step);
+      unsigned int most = _late ? 1 : MAX_SUBSTEPS;
+      if(_substeps > most){
+        _droppedSteps += _substeps - most;
+        _substeps = most;
+        _owed = 0.0;
+      }else{
+        _owed -= _substeps * step;
+      }
+    }
+    _steps += _substeps;
+    _previousStart = now;
+    _frameStart = now;
+  }
+
+  // Simulation steps to run this frame
+  unsigned int substeps( ) const{
+    return _substeps;
+  }
+
+  void endFrame( ){
+    if(_timing){
+      glEndQuery(GL_TIME_ELAPSED);
+      _timing = false;
+      _query = (_query + 1) % QUERIES;
+      _queriesInFlight++;
+    }
+    double cpu = seconds( ) - _frameStart;
+    _cpuTime += cpu;
+    _cpuWorst = cpu > _cpuWorst ? cpu : _cpuWorst;
+    _late = _targetRate > 0.0 && cpu > 1.0 / _targetRate;
+  }
+
+  // Holds an UNCAPPED frame back to the target rate
+  void wait( ){
+    if(_mode != UNCAPPED || _targetRate <= 0.0){
+      return;
+    }
+    double period = 1.0 / _targetRate;
+    double now = seconds( );
+    // A frame that missed its deadline by more than a period starts
+    // the schedule over rather than rushing the next ones.
+    if(_deadline == 0.0 || now > _deadline + period){
+      _deadline = now + period;
+      return;
+    }
+    double sleep = _deadline - now - SPIN_SECONDS;
+    if(sleep > 0.0){
+      std::this_thread::sleep_for(std::chrono::duration<double>(sleep));
+    }
+    while(seconds( ) < _deadline){
+    }
+    _deadline += period;
+  }
+
+  void presented( ){
+    double now = seconds( );
+    if(_previousPresent > 0.0){
+      double interval = now - _previousPresent;
+      _presentTime += interval;
+      _presentWorst = interval > _presentWorst ? interval : _presentWorst;
+      _presents++;
+      // Half a period of slack, as vsync rounds up to whole periods
+      if(_targetRate > 0.0 && interval > 1.5 / _targetRate){
+        _late = true;
+      }
+    }
+    _previousPresent = now;
+    if(_late){
+      _lateFrames++;
+      _lateRun++;
+      _onTimeRun = 0;
+    }else{
+      _onTimeRun++;
+      _lateRun = 0;
+    }
+    if(_mode == ADAPTIVE){
+      if(_interval == 1 && _lateRun >= LATE_FRAMES){
+        _interval = 0;
+      }else if(_interval == 0 && _onTimeRun >= ON_TIME_FRAMES){
+        _interval = 1;
+      }
+    }
+    _frames++;
+  }
+
+  // Forgets the times measured so far
+  void reset( ){
+    _frames = 0;
+    _presents = 0;
+    _gpuFrames = 0;
+    _lateFrames = 0;
+    _steps = 0;
+    _droppedSteps = 0;
+    _cpuTime = 0.0;
+    _cpuWorst = 0.0;
+    _gpuTime = 0.0;
+    _gpuWorst = 0.0;
+    _presentTime = 0.0;
+    _presentWorst = 0.0;
+  }
+
+  // Average and worst times since the last reset( ), which it calls
+  void report(FILE* out){
+    if(_frames == 0){
+      return;
+    }
+    fprintf(out, "Frame pacing (%s", name(_mode));
+    if(_targetRate > 0.0 && _mode != VSYNC){
+      fprintf(out, " at %.0f fps", _targetRate);
+    }
+    fprintf(out, "): CPU %.3f ms (worst %.3f), ", 1000.0 * _cpuTime / _frames, 1000.0 * _cpuWorst);
+    if(_gpuFrames > 0){
+      fprintf(out, "GPU %.3f ms (worst %.3f), ", 1000.0 * _gpuTime / _gpuFrames, 1000.0 * _gpuWorst);
+    }else{
+      fprintf(out, "GPU not timed, ");
+    }
+    if(_presents > 0){
+      fprintf(out, "present to present %.3f ms (worst %.3f); ", 1000.0 * _presentTime / _presents, 1000.0 * _presentWorst);
+    }
+    fprintf(out, "%u of %u frames late, %u simulation steps run, %u dropped\n", _lateFrames, _frames, _steps, _droppedSteps);
+    reset( );
+  }
+
+private:
+  // How long before a deadline wait( ) stops sleeping and spins
+  static constexpr double SPIN_SECONDS = 0.002;
+
+  pacemode_t _mode;
+  double _targetRate;
+  bool _lockstep;
+  int _interval;
+
+  double _frameStart;
+  double _previousStart;
+  double _previousPresent;
+  double _deadline;
+  // Simulation time not yet stepped
+  double _owed;
+  unsigned int _substeps;
+  bool _late;
+  unsigned int _lateRun;
+  unsigned int _onTimeRun;
+
+  GLuint _queries[QUERIES];
+  int _query;
+  int _queriesInFlight;
+  bool _timing;
+
+  unsigned int _frames;
+  unsigned int _presents;
+  unsigned int _gpuFrames;
+  unsigned int _lateFrames;
+  unsigned int _steps;
+  unsigned int _droppedSteps;
+  double _cpuTime;
+  double _cpuWorst;
+  double _gpuTime;
+  double _gpuWorst;
+  double _presentTime;
+  double _presentWorst;
+
+  // Reads every finished query, oldest first, and stops at the first
+  // that is not; the one about to be reused is waited for, which after
+  // QUERIES - 1 frames it seldom is.
+  void collectQueries( ){
+    while(_queriesInFlight > 0){
+      int oldest = (_query - _queriesInFlight + QUERIES) % QUERIES;
+      GLint available = 0;
+      if(_queriesInFlight < QUERIES){
+        glGetQueryObjectiv(_queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available){
+          break;
+        }
+      }
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(_queries[oldest], GL_QUERY_RESULT, &elapsed);
+      double gpu = double(elapsed) * 1e-9;
+      _gpuTime += gpu;
+      _gpuWorst = gpu > _gpuWorst ? gpu : _gpuWorst;
+      _gpuFrames++;
+      _queriesInFlight--;
+    }
+  }
+
+  FramePacer(const FramePacer&);
+  FramePacer& operator=(const FramePacer&);
+};
+
+#endif
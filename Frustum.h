@@ -0,0 +1,204 @@
+//
+// View frustum culling of axis aligned bounding boxes.
+//
+// The six planes are extracted from a projection * view matrix
+// (Gribb and Hartmann) and normalized so the inside of each is
+// positive. A box is rejected when it lies entirely on the outside
+// of any plane; a box straddling the corner outside two planes but
+// no single one is kept, which is conservative.
+//
+// Boxes are tested in batches held as structure of arrays, four at
+// a time with SSE when the compiler targets it.
+//
+//
+
+#include <cmath>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#ifndef _FRUSTUM_H_
+#define _FRUSTUM_H_
+
+// Centers and half extents of many boxes, one array per coordinate,
+// padded with at least three floats past the last box so four can be
+// loaded as a vector starting at any box.
+class AABBBatch{
+public:
+  AABBBatch( ) : _size(0){ }
+
+  void clear( ){
+    _size = 0;
+    for(int i = 0; i < 6; i++){
+      _data[i].clear( );
+    }
+  }
+
+  void add(const glm::vec3& center, const glm::vec3& halfExtent){
+    if(_data[0].size( ) < _size + 4){
+      for(int i = 0; i < 6; i++){
+        _data[i].resize(_size + 4, 0.0f);
+      }
+    }
+    _data[0][_size] = center.x;
+    _data[1][_size] = center.y;
+    _data[2][_size] = center.z;
+    _data[3][_size] = halfExtent.x;
+    _data[4][_size] = halfExtent.y;
+    _data[5][_size] = halfExtent.z;
+    _size++;
+  }
+
+  size_t size( ) const{
+    return _size;
+  }
+
+  const float* centerX( ) const{ return &_data[0][0]; }
+  const float* centerY( ) const{ return &_data[1][0]; }
+  const float* centerZ( ) const{ return &_data[2][0]; }
+  const float* extentX( ) const{ return &_data[3][0]; }
+  const float* extentY( ) const{ return &_data[4][0]; }
+  const float* extentZ( ) const{ return &_data[5][0]; }
+
+  glm::vec3 center(size_t i) const{
+    return glm::vec3(_data[0][i], _data[1][i], _data[2][i]);
+  }
+
+  glm::vec3 halfExtent(size_t i) const{
+    return glm::vec3(_data[3][i], _data[4][i], _data[5][i]);
+  }
+
+private:
+  size_t _size;
+  std::vector<float> _data[6];
+};
+
+class Frustum{
+public:
+  static const int PLANES = 6;
+
+  Frustum( ){
+    for(int i = 0; i < PLANES; i++){
+      _planes[i] = glm::vec4(0.0, 0.0, 0.0, 1.0);
+    }
+  }
+
+  // viewProjection maps world space to clip space
+  Frustum(const glm::mat4& viewProjection){
+    extract(viewProjection);
+  }
+
+  void extract(const glm::mat4& m){
+    // Rows of the matrix; glm is column major.
+    glm::vec4 row[4];
+    for(int i = 0; i < 4; i++){
+      row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+    _planes[0] = row[3] + row[0]; // left
+    _planes[1] = row[3] - row[0]; // right
+    _planes[2] = row[3] + row[1]; // bottom
+    _planes[3] = row[3] - row[1]; // top
+    _planes[4] = row[3] + row[2]; // near
+    _planes[5] = row[3] - row[2]; // far
+    for(int i = 0; i < PLANES; i++){
+      _planes[i] /= glm::length(glm::vec3(_planes[i]));
+    }
+  }
+
+  const glm::vec4& plane(int i) const{
+    return _planes[i];
+  }
+
+  typedef enum{
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE
+  }containment_t;
+
+  // Whether a box is wholly outside, wholly inside or across the
+  // boundary; hierarchies accept or reject whole subtrees with it.
+  containment_t classify(const glm::vec3& center, const glm::vec3& halfExtent) const{
+    containment_t rv = INSIDE;
+    for(int i = 0; i < PLANES; i++){
+      const glm::vec4& p = _planes[i];
+      float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+      float radius = fabs(p.x) * halfExtent.x + fabs(p.y) * halfExtent.y + fabs(p.z) * halfExtent.z;
+      if(distance < -radius){
+        return OUTSIDE;
+      }
+      if(distance < radius){
+        rv = INTERSECTING;
+      }
+    }
+    return rv;
+  }
+
+  bool intersects(const glm::vec3& center, const glm::vec3& halfExtent) const{
+    for(int i = 0; i < PLANES; i++){
+      const glm::vec4& p = _planes[i];
+      float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+      float radius = fabs(p.x) * halfExtent.x + fabs(p.y) * halfExtent.y + fabs(p.z) * halfExtent.z;
+      if(distance < -radius){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Sets visible[j] to 1 when box first + j of the batch may be in
+  // view and 0 when not, for j below n; returns how many may be.
+  size_t cull(const AABBBatch& boxes, size_t first, size_t n, unsigned char* visible) const{
+    size_t count = 0;
+    const float *cx = boxes.centerX( ) + first, *cy = boxes.centerY( ) + first, *cz = boxes.centerZ( ) + first;
+    const float *ex = boxes.extentX( ) + first, *ey = boxes.extentY( ) + first, *ez = boxes.extentZ( ) + first;
+    size_t i = 0;
+#ifdef __SSE__
+    __m128 px[PLANES], py[PLANES], pz[PLANES], pw[PLANES];
+    __m128 ax[PLANES], ay[PLANES], az[PLANES];
+    for(int k = 0; k < PLANES; k++){
+      px[k] = _mm_set1_ps(_planes[k].x);
+      py[k] = _mm_set1_ps(_planes[k].y);
+      pz[k] = _mm_set1_ps(_planes[k].z);
+      pw[k] = _mm_set1_ps(_planes[k].w);
+      ax[k] = _mm_set1_ps(fabs(_planes[k].x));
+      ay[k] = _mm_set1_ps(fabs(_planes[k].y));
+      az[k] = _mm_set1_ps(fabs(_planes[k].z));
+    }
+    const __m128 zero = _mm_setzero_ps( );
+    // The batch is padded, so the last group of four is always there
+    // to load; lanes past n are ignored.
+    for(; i < n; i += 4){
+      __m128 x = _mm_loadu_ps(cx + i), y = _mm_loadu_ps(cy + i), z = _mm_loadu_ps(cz + i);
+      __m128 hx = _mm_loadu_ps(ex + i), hy = _mm_loadu_ps(ey + i), hz = _mm_loadu_ps(ez + i);
+      __m128 inside = _mm_cmpeq_ps(zero, zero);
+      for(int k = 0; k < PLANES; k++){
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[k], x), _mm_mul_ps(py[k], y)),
+                                     _mm_add_ps(_mm_mul_ps(pz[k], z), pw[k]));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[k], hx), _mm_mul_ps(ay[k], hy)), _mm_mul_ps(az[k], hz));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+      }
+      int mask = _mm_movemask_ps(inside);
+      for(size_t j = 0; j < 4 && i + j < n; j++){
+        visible[i + j] = (mask >> j) & 1;
+        count += visible[i + j];
+      }
+    }
+#endif
+    for(; i < n; i++){
+      visible[i] = intersects(glm::vec3(cx[i], cy[i], cz[i]), glm::vec3(ex[i], ey[i], ez[i])) ? 1 : 0;
+      count += visible[i];
+    }
+    return count;
+  }
+
+private:
+  // (normal, distance) with the normal pointing into the frustum
+  glm::vec4 _planes[PLANES];
+};
+
+#endif
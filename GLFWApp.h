@@ -66,6 +66,8 @@
 //#define GLFW_INCLUDE_GLCOREARB
 #include <GLFW/glfw3.h>
 
+#include "FramePacer.h"
+
 class GLFWApp{
  public:
 
@@ -96,12 +98,16 @@ class GLFWApp{
   GLFWApp(int argc, char* argv[], const char* windowTitle,
           int windowSize_X, int windowSize_Y,
           int major = 2, int minor = 1,
-          std::tuple<int, int> const & position = std::make_tuple(100, 100)) :
+          std::tuple<int, int> const & position = std::make_tuple(100, 100),
+          profile_t profile = COMPATIBILITY) :
   _window(nullptr),
     _windowTitle(windowTitle),
     _major(major),
     _minor(minor),
-    _mouseButtonFlags(0) {
+    _profile(profile),
+    _mouseButtonFlags(0),
+    // Not an interval, so the first sync( ) always sets one
+    _swapInterval(-2) {
     _mousePreviousPosition = std::make_tuple(windowSize_X / 2.0, windowSize_Y / 2.0);
     _mouseCurrentPosition = _mousePreviousPosition;
     memset(&_keyPressed[0], 0, sizeof(_keyPressed));
@@ -113,13 +119,27 @@ class GLFWApp{
     glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, _major);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, _minor);
-		
-    /* When you want core profile
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    */
-    
+    // Profiles exist from OpenGL 3.2 on. A forward compatible core
+    // context has none of the deprecated fixed function entry points.
+    if(_profile == CORE && _myGLVersion( ) >= 320){
+      glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+      glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    }else{
+      _profile = COMPATIBILITY;
+    }
+
     _window = glfwCreateWindow(windowSize_X, windowSize_Y, windowTitle, nullptr, nullptr);
+    if(!_window && _profile == CORE){
+      fprintf(stderr, "No OpenGL %d.%d core profile context; falling back to 2.1 compatibility\n", _major, _minor);
+      _major = 2;
+      _minor = 1;
+      _profile = COMPATIBILITY;
+      glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, _major);
+      glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, _minor);
+      glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_ANY_PROFILE);
+      glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_FALSE);
+      _window = glfwCreateWindow(windowSize_X, windowSize_Y, windowTitle, nullptr, nullptr);
+    }
     if(_window){
       glfwSetWindowPos(_window, std::get<0>(position), std::get<1>(position));
       glfwSetWindowUserPointer(_window, this);
@@ -129,6 +149,10 @@ class GLFWApp{
       glfwMakeContextCurrent(_window);
       glewExperimental = GL_TRUE;
       glewInit( );
+      // glewInit( ) queries GL_EXTENSIONS, which a core context rejects
+      // with GL_INVALID_ENUM; that error is not the caller's.
+      while(glGetError( ) != GL_NO_ERROR){
+      }
       sync(VSYNC);
     	FreeImage_Initialise( );
       assert(checkGLError("Constructor"));
@@ -140,27 +164,35 @@ class GLFWApp{
 
   virtual ~GLFWApp( ){
     if(_window){
+      _pacer.release( );
       glfwDestroyWindow(_window);
     }
   	FreeImage_DeInitialise( );
     glfwTerminate( );
   }
 
+  // Sets the pacer's mode; TEARING is its adaptive mode. See
+  // FramePacer.h.
   void sync(syncmode_t const & sync){
     switch(sync){
     case ASYNC:
-      glfwSwapInterval(0);
+      _pacer.setMode(FramePacer::UNCAPPED, 0.0);
       break;
     case VSYNC:
-      glfwSwapInterval(1);
+      _pacer.setMode(FramePacer::VSYNC);
       break;
     case TEARING:
-      glfwSwapInterval(-1);
+      _pacer.setMode(FramePacer::ADAPTIVE);
       break;
     default:
       fprintf(stderr, "No such syncmode. (%d)\n", sync);
       break;
     }
+    _applySwapInterval( );
+  }
+
+  FramePacer& pacer( ){
+    return _pacer;
   }
 
   void swap( ){
@@ -171,6 +203,12 @@ class GLFWApp{
   virtual bool render( ) = 0;
   virtual bool end( ) = 0;
 
+  // Called once a frame after events are handled, for work that
+  // belongs to neither rendering nor input, such as noticing edited
+  // files.
+  virtual void poll( ){
+  }
+
   void windowShouldClose( ){
     glfwSetWindowShouldClose(_window, GL_TRUE);
   }
@@ -180,13 +218,19 @@ class GLFWApp{
     if(_window != 0){
       rv = this->begin() ? EXIT_SUCCESS : EXIT_FAILURE;
       while(rv == EXIT_SUCCESS){
+        _pacer.beginFrame( );
         rv = this->render() ? EXIT_SUCCESS : EXIT_FAILURE;
         rv = rv && this->checkGLError("Render");
+        _pacer.endFrame( );
         glfwPollEvents( );
+        poll( );
         if(glfwWindowShouldClose(_window)){
           break;
         }
+        _applySwapInterval( );
+        _pacer.wait( );
         swap( );
+        _pacer.presented( );
       }
       rv = rv && this->end();
     }
@@ -214,6 +258,16 @@ class GLFWApp{
     return _window;
   }
 
+  // The profile of the context actually created, which is
+  // COMPATIBILITY when a core context was asked for but unavailable.
+  profile_t profile( ) const{
+    return _profile;
+  }
+
+  bool isCoreProfile( ) const{
+    return _profile == CORE;
+  }
+
   bool isKeyPressed(int key) const{
     return _keyPressed[key];
   }
@@ -275,10 +329,21 @@ class GLFWApp{
   std::string _windowTitle;
   int _major;
   int _minor;
+  profile_t _profile;
   std::array<bool, 512> _keyPressed;
   int _mouseButtonFlags;
   std::tuple<float, float> _mousePreviousPosition;
   std::tuple<float, float> _mouseCurrentPosition;
+  FramePacer _pacer;
+  int _swapInterval;
+
+  // The adaptive mode changes the interval from frame to frame
+  void _applySwapInterval( ){
+    if(_pacer.swapInterval( ) != _swapInterval){
+      _swapInterval = _pacer.swapInterval( );
+      glfwSwapInterval(_swapInterval);
+    }
+  }
 
   static void _mouseButtonCallback(GLFWwindow* window, int button, int action, int mods){
     GLFWApp *app = reinterpret_cast<GLFWApp*>(glfwGetWindowUserPointer(window));
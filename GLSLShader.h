@@ -42,6 +42,7 @@
 #include <cstring>
 
 #include <string>
+#include <algorithm>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -133,6 +134,34 @@ char* file2strings( const char *filename ){
   return( strings );
 }
 
+// Returns source with defines, whole "#define NAME VALUE" lines,
+// inserted just after the #version directive, which has to stay the
+// first thing in a shader.
+std::string injectDefines( const std::string& source, const std::string& defines ){
+  size_t lineStart = 0;
+  while( lineStart < source.size( ) ){
+    size_t lineEnd = source.find( '\n', lineStart );
+    if( lineEnd == std::string::npos ){
+      lineEnd = source.size( );
+    }
+    size_t i = source.find_first_not_of( " \t", lineStart );
+    if( i < lineEnd && source[i] == '#' ){
+      i = source.find_first_not_of( " \t", i + 1 );
+      if( i < lineEnd && source.compare( i, 7, "version" ) == 0 ){
+        std::string rv = source.substr( 0, lineEnd );
+        rv += "\n";
+        rv += defines;
+        if( lineEnd < source.size( ) ){
+          rv += source.substr( lineEnd + 1 );
+        }
+        return( rv );
+      }
+    }
+    lineStart = lineEnd + 1;
+  }
+  return( defines + source );
+}
+
 class Shader{
 public:
   GLuint _object;
@@ -149,12 +178,23 @@ public:
   }
 
   bool compileShader( const GLchar *src ){
-    GLint compiled_ok;
-    char *msg;
+    startCompile( src );
+    return( compiled( ) );
+  }
+
+  // Hands src to the compiler without waiting for the result; with
+  // parallel shader compilation the driver works in the background
+  // until compiled( ) asks.
+  void startCompile( const GLchar *src ){
     GLint length = (GLint)strlen(src);
     glShaderSource( _object, 1, &src, &length );
     glCompileShader( _object );
     msglError( );
+  }
+
+  bool compiled( ){
+    GLint compiled_ok;
+    char *msg;
     glGetShaderiv( _object, GL_COMPILE_STATUS, &compiled_ok );
     msglError( );
     if( !compiled_ok ){
@@ -191,6 +231,21 @@ public:
     free( src );
   }
 
+  // Compiles source; srcFileName only names the shader in messages.
+  // Unless wait is true the result is left for compiled( ).
+  VertexShader( const char *srcFileName, const std::string& source, bool wait = true ) : Shader(srcFileName){
+    if( (Shader::_object = glCreateShader( GL_VERTEX_SHADER )) == 0 ){
+      fprintf( stderr, "Can't generate vertex shader name\n" );
+    }
+    msglError( );
+    if( wait ){
+      compileShader( source.c_str( ) );
+    }else{
+      startCompile( source.c_str( ) );
+    }
+    msglError( );
+  }
+
   GLuint object( ){
     return Shader::_object;
   }
@@ -212,6 +267,20 @@ public:
       free( src );
     }
 
+  // Compiles source; srcFileName only names the shader in messages.
+  // Unless wait is true the result is left for compiled( ).
+  FragmentShader( const char *srcFileName, const std::string& source, bool wait = true ) : Shader(srcFileName){
+    if( (Shader::_object = glCreateShader( GL_FRAGMENT_SHADER )) == 0 ){
+      fprintf( stderr, "Can't generate fragment shader name\n" );
+      exit(1);
+    }
+    if( wait ){
+      compileShader( source.c_str( ) );
+    }else{
+      startCompile( source.c_str( ) );
+    }
+  }
+
     GLuint object( ){
       return Shader::_object;
     }
@@ -233,7 +302,7 @@ public:
     _texture = NULL;
   }
 
-  ~GLSLProgram( ){
+  virtual ~GLSLProgram( ){
     detachAll( );
     glDeleteProgram( _object );
   }
@@ -241,6 +310,13 @@ public:
   GLuint id( ){
     return _object;
   }
+
+  // Exchanges the GL programs behind this and other, so a rebuilt
+  // program can replace a live one in place.
+  void swap( GLSLProgram &other ){
+    std::swap( _object, other._object );
+    std::swap( _texture, other._texture );
+  }
   
   bool attach( FragmentShader &fs ){
     glAttachShader( _object, fs.object( ) );
@@ -252,6 +328,12 @@ public:
     return( !msglError( ) );
   }
 
+  // Generic attributes must be bound before link( ) to take effect.
+  bool bindAttribLocation( GLuint index, const char *name ){
+    glBindAttribLocation( _object, index, name );
+    return( !msglError( ) );
+  }
+
   bool detachAll( ){
     bool ret = false;
     GLsizei const maxCount = 32;
@@ -283,11 +365,31 @@ public:
   }
 
   bool link( ){
+    startLink( );
+    return( linked( ) );
+  }
+
+  // Links without waiting for the result, which linked( ) reports.
+  void startLink( ){
+    glLinkProgram( _object );
+  }
+
+  // Whether the compiles and link started so far have finished, so
+  // that linked( ) will not stall. Always true without
+  // ARB_parallel_shader_compile, where the driver works synchronously.
+  bool ready( ){
+    if( !(GLEW_ARB_parallel_shader_compile || GLEW_KHR_parallel_shader_compile) ){
+      return( true );
+    }
+    GLint done = GL_FALSE;
+    glGetProgramiv( _object, GL_COMPLETION_STATUS_ARB, &done );
+    return( done == GL_TRUE );
+  }
+
+  bool linked( ){
     GLint linked_ok;
     char *msg;
     bool ret = true;
-  
-    glLinkProgram( _object );
 
     glGetProgramiv( _object, GL_LINK_STATUS, &linked_ok );
     if( !linked_ok ){
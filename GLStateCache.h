@@ -0,0 +1,243 @@
+//
+// A shadow copy of the GL binding and uniform state.
+//
+// Binds and uniform uploads made through the cache are skipped
+// when they would not change anything. Every class that binds a
+// program, texture, buffer or vertex array goes through the one
+// cache returned by GLStateCache::current( ) so the shadow copy
+// stays truthful; code that calls GL directly must invalidate( )
+// it afterwards.
+//
+// The cache counts, per frame, how many calls it issued and how
+// many it elided.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <GL/glew.h>
+
+#ifndef _GL_STATE_CACHE_H_
+#define _GL_STATE_CACHE_H_
+
+class GLStateCache{
+public:
+  typedef enum{
+    PROGRAM,
+    TEXTURE,
+    BUFFER,
+    VERTEX_ARRAY,
+    UNIFORM,
+    CALL_KINDS
+  }callkind_t;
+
+  static GLStateCache& current( ){
+    static GLStateCache cache;
+    return cache;
+  }
+
+  // Forget everything; the next bind of each kind is always issued.
+  void invalidate( ){
+    _program = UNKNOWN;
+    _activeTexture = UNKNOWN;
+    for(int i = 0; i < TEXTURE_UNITS; i++){
+      _texture2D[i] = UNKNOWN;
+      _texture2DArray[i] = UNKNOWN;
+    }
+    _arrayBuffer = UNKNOWN;
+    _uniformBuffer = UNKNOWN;
+    _vertexArray = UNKNOWN;
+    _uniforms.clear( );
+    _programUniforms = NULL;
+  }
+
+  void useProgram(GLuint program){
+    if(count(PROGRAM, program != _program)){
+      glUseProgram(program);
+      _program = program;
+      if(_uniforms.size( ) <= program){
+        _uniforms.resize(program + 1);
+      }
+      _programUniforms = &_uniforms[program];
+    }
+  }
+
+  GLuint program( ) const{
+    return _program;
+  }
+
+  void bindTexture(GLenum unit, GLenum target, GLuint texture){
+    int i = unit - GL_TEXTURE0;
+    GLuint* bound = target == GL_TEXTURE_2D_ARRAY_EXT ? &_texture2DArray[i] : &_texture2D[i];
+    if(count(TEXTURE, texture != *bound)){
+      activeTexture(unit);
+      glBindTexture(target, texture);
+      *bound = texture;
+    }
+  }
+
+  // Selects the unit that glTexImage* and glTexParameter* act on; a
+  // bindTexture( ) that is skipped leaves the active unit unchanged.
+  void activeTexture(GLenum unit){
+    if(unit != _activeTexture){
+      glActiveTexture(unit);
+      _activeTexture = unit;
+    }
+  }
+
+  // The element array binding belongs to the vertex array object and
+  // is not tracked here.
+  void bindBuffer(GLenum target, GLuint buffer){
+    GLuint* bound = target == GL_UNIFORM_BUFFER ? &_uniformBuffer : &_arrayBuffer;
+    if(target != GL_ARRAY_BUFFER && target != GL_UNIFORM_BUFFER){
+      count(BUFFER, true);
+      glBindBuffer(target, buffer);
+      return;
+    }
+    if(count(BUFFER, buffer != *bound)){
+      glBindBuffer(target, buffer);
+      *bound = buffer;
+    }
+  }
+
+  // Binding a range to an indexed binding point also sets the
+  // target's generic binding.
+  void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size){
+    count(BUFFER, true);
+    glBindBufferRange(target, index, buffer, offset, size);
+    if(target == GL_ARRAY_BUFFER || target == GL_UNIFORM_BUFFER){
+      *(target == GL_UNIFORM_BUFFER ? &_uniformBuffer : &_arrayBuffer) = buffer;
+    }
+  }
+
+  void bindVertexArray(GLuint vertexArray){
+    if(count(VERTEX_ARRAY, vertexArray != _vertexArray)){
+      glBindVertexArray(vertexArray);
+      _vertexArray = vertexArray;
+    }
+  }
+
+  // Uniforms are remembered per program and location; uploads of the
+  // value already held by the current program are skipped. Values
+  // larger than a mat4, such as whole arrays, are always uploaded.
+  void uniform1i(GLint location, GLint value){
+    if(changed(location, &value, sizeof(value))){
+      glUniform1i(location, value);
+    }
+  }
+
+  void uniform1f(GLint location, GLfloat value){
+    if(changed(location, &value, sizeof(value))){
+      glUniform1f(location, value);
+    }
+  }
+
+  void uniform4fv(GLint location, GLsizei n, const GLfloat* value){
+    if(changed(location, value, n * 4 * sizeof(GLfloat))){
+      glUniform4fv(location, n, value);
+    }
+  }
+
+  void uniformMatrix4fv(GLint location, GLsizei n, const GLfloat* value){
+    if(changed(location, value, n * 16 * sizeof(GLfloat))){
+      glUniformMatrix4fv(location, n, GL_FALSE, value);
+    }
+  }
+
+  // Starts a new frame's counters; the finished frame's are kept for
+  // report( ).
+  void beginFrame( ){
+    memcpy(_lastIssued, _issued, sizeof(_issued));
+    memcpy(_lastElided, _elided, sizeof(_elided));
+    memset(_issued, 0, sizeof(_issued));
+    memset(_elided, 0, sizeof(_elided));
+  }
+
+  unsigned int issued(callkind_t kind) const{
+    return _lastIssued[kind];
+  }
+
+  unsigned int elided(callkind_t kind) const{
+    return _lastElided[kind];
+  }
+
+  void report(FILE* out) const{
+    static const char* names[CALL_KINDS] = {"program", "texture", "buffer", "vertex array", "uniform"};
+    fprintf(out, "GL state calls issued/elided last frame:");
+    for(int i = 0; i < CALL_KINDS; i++){
+      fprintf(out, " %s %u/%u", names[i], _lastIssued[i], _lastElided[i]);
+    }
+    fprintf(out, "\n");
+  }
+
+private:
+  static const GLuint UNKNOWN = ~0u;
+  static const int TEXTURE_UNITS = 16;
+  static const size_t UNIFORM_BYTES = 16 * sizeof(GLfloat);
+
+  // The value last uploaded to one location; bytes is 0 until then
+  struct Uniform{
+    size_t bytes;
+    unsigned char value[UNIFORM_BYTES];
+
+    Uniform( ) : bytes(0){ }
+  };
+
+  GLuint _program;
+  GLenum _activeTexture;
+  GLuint _texture2D[TEXTURE_UNITS];
+  GLuint _texture2DArray[TEXTURE_UNITS];
+  GLuint _arrayBuffer;
+  GLuint _uniformBuffer;
+  GLuint _vertexArray;
+  // Indexed by program name, then by location, so a lookup is two
+  // array indexings; a program's row only grows to its highest
+  // location, the first time that is set.
+  std::vector<std::vector<Uniform> > _uniforms;
+  // The current program's row, NULL while the program is unknown
+  std::vector<Uniform>* _programUniforms;
+  unsigned int _issued[CALL_KINDS];
+  unsigned int _elided[CALL_KINDS];
+  unsigned int _lastIssued[CALL_KINDS];
+  unsigned int _lastElided[CALL_KINDS];
+
+  GLStateCache( ){
+    invalidate( );
+    memset(_issued, 0, sizeof(_issued));
+    memset(_elided, 0, sizeof(_elided));
+    beginFrame( );
+  }
+
+  bool count(callkind_t kind, bool issue){
+    if(issue){
+      _issued[kind]++;
+    }else{
+      _elided[kind]++;
+    }
+    return issue;
+  }
+
+  bool changed(GLint location, const void* value, size_t bytes){
+    if(location < 0){
+      return false;
+    }
+    if(!_programUniforms || bytes > UNIFORM_BYTES){
+      return count(UNIFORM, true);
+    }
+    if(_programUniforms->size( ) <= size_t(location)){
+      _programUniforms->resize(location + 1);
+    }
+    Uniform& held = (*_programUniforms)[location];
+    bool issue = held.bytes != bytes || memcmp(held.value, value, bytes) != 0;
+    if(issue){
+      memcpy(held.value, value, bytes);
+      held.bytes = bytes;
+    }
+    return count(UNIFORM, issue);
+  }
+
+  GLStateCache(const GLStateCache&);
+  GLStateCache& operator=(const GLStateCache&);
+};
+
+#endif
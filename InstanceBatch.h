@@ -0,0 +1,117 @@
+//
+// Instanced drawing of one mesh many times.
+//
+// Each instance is a position, a per-axis scale, a material index
+// and an image in a TextureArray (a layer and a texture coordinate
+// rectangle). The instances are written every frame
+// directly into a StreamBuffer region and the whole batch is drawn
+// with a single glDrawElementsInstanced; the model and normal
+// matrices are rebuilt from the per-instance attributes in the
+// vertex shader.
+//
+//
+
+#include <cstddef>
+#include <GL/glew.h>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "Mesh.h"
+#include "StreamBuffer.h"
+#include "GLStateCache.h"
+
+#ifndef _INSTANCE_BATCH_H_
+#define _INSTANCE_BATCH_H_
+
+struct InstanceData{
+  glm::vec3 position;
+  glm::vec3 scale;
+  // Floats so the pair is a single vec2 attribute in GLSL 1.20
+  float materialID;
+  float textureLayer;
+  // (u offset, v offset, u extent, v extent), see TextureArray::rect
+  glm::vec4 textureRect;
+};
+
+class InstanceBatch{
+public:
+  InstanceBatch( ) : _stream(GL_ARRAY_BUFFER, sizeof(InstanceData)), _count(0){ }
+
+  // Instanced arrays (attribute divisors) and instanced draw calls
+  // are both required; without them the caller draws per object.
+  // Both are core in OpenGL 3.3, whose core profile contexts need not
+  // list the ARB extensions.
+  static bool supported( ){
+    return GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced);
+  }
+
+  // Returns room for up to capacity instances for this frame, to be
+  // written in place and then handed back with unmap( ).
+  InstanceData* map(size_t capacity){
+    _count = 0;
+    return (InstanceData*)_stream.map(capacity * sizeof(InstanceData));
+  }
+
+  void unmap(size_t count){
+    _count = count;
+    _stream.unmap(count * sizeof(InstanceData));
+  }
+
+  size_t size( ) const{
+    return _count;
+  }
+
+  bool persistent( ) const{
+    return _stream.persistent( );
+  }
+
+  // Draws every instance written this frame.
+  void draw(Mesh& mesh){
+    draw(mesh, 0, _count);
+    fence( );
+  }
+
+  // Draws count of this frame's instances starting at first, so one
+  // map( ) can feed several draws of different meshes or textures.
+  // Call fence( ) once the last of them has been issued.
+  void draw(Mesh& mesh, size_t first, size_t count){
+    if(count == 0){
+      return;
+    }
+    mesh.bind( );
+    GLStateCache::current( ).bindBuffer(GL_ARRAY_BUFFER, _stream.buffer( ));
+    // This frame's instances start at the region's offset; the range
+    // is selected by moving the attribute pointers.
+    char* base = (char*)(_stream.offset( ) + first * sizeof(InstanceData));
+    glVertexAttribPointer(ATTRIB_INSTANCE_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, position));
+    glVertexAttribPointer(ATTRIB_INSTANCE_SCALE, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, scale));
+    glVertexAttribPointer(ATTRIB_INSTANCE_PARAMS, 2, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, materialID));
+    glVertexAttribPointer(ATTRIB_INSTANCE_TEXRECT, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, textureRect));
+    for(GLuint a = ATTRIB_INSTANCE_POSITION; a <= ATTRIB_INSTANCE_TEXRECT; a++){
+      glEnableVertexAttribArray(a);
+      if(GLEW_VERSION_3_3){
+        glVertexAttribDivisor(a, 1);
+      }else{
+        glVertexAttribDivisorARB(a, 1);
+      }
+    }
+    if(GLEW_VERSION_3_3){
+      glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount( ), GL_UNSIGNED_INT, 0, (GLsizei)count);
+    }else{
+      glDrawElementsInstancedARB(GL_TRIANGLES, mesh.indexCount( ), GL_UNSIGNED_INT, 0, (GLsizei)count);
+    }
+  }
+
+  void fence( ){
+    _stream.fence( );
+  }
+
+private:
+  StreamBuffer _stream;
+  size_t _count;
+
+  InstanceBatch(const InstanceBatch&);
+  InstanceBatch& operator=(const InstanceBatch&);
+};
+
+#endif
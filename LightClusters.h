@@ -0,0 +1,477 @@
+//
+// Clustered forward lighting for many point lights.
+//
+// The view volume is divided into TILES_X * TILES_Y screen tiles
+// and SLICES depth slices, spaced exponentially between the near and
+// far planes so clusters stay roughly cubic. Every frame update( )
+// moves the lights into eye space, finds the clusters each light's
+// sphere of influence reaches and writes one list of light indices
+// per cluster. A fragment finds its cluster from gl_FragCoord and its
+// depth and shades with that list only, so hundreds of small lights
+// cost about as much per pixel as the few that overlap it.
+//
+// Lights are binned four at a time with SSE when the compiler
+// targets it: the eye space transform and the conservative tile and
+// slice range of each sphere are computed for four lights together.
+// Each cluster in that range is then checked against the sphere with
+// the cluster's eye space bounding box.
+//
+// The shaders read three float textures, TEXTURE_WIDTH texels wide:
+// the lights (eye space position and radius, then color), the grid
+// (offset and count of each cluster's list) and the lists. Plain
+// 2D float textures work on OpenGL 2.1 with ARB_texture_float, where
+// buffer textures and storage buffers do not exist.
+//
+// A light with a radius of 0 reaches everywhere without falloff and
+// is in every cluster; the two SpinningLights are such lights.
+//
+//
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <GL/glew.h>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "GLStateCache.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#ifndef _LIGHT_CLUSTERS_H_
+#define _LIGHT_CLUSTERS_H_
+
+struct PointLight{
+  // World space
+  glm::vec3 position;
+  // Distance at which the light fades to nothing; 0 for no falloff
+  float radius;
+  glm::vec4 color;
+};
+
+class LightClusters{
+public:
+  static const int TILES_X = 16;
+  static const int TILES_Y = 16;
+  static const int SLICES = 16;
+  static const int CLUSTERS = TILES_X * TILES_Y * SLICES;
+  // Lights one cluster can hold; MAX_CLUSTER_LIGHTS in the shaders
+  static const int MAX_PER_CLUSTER = 64;
+  static const int TEXTURE_WIDTH = 1024;
+
+  // Texture units of the light, grid and index textures
+  static const int LIGHT_UNIT = 1;
+  static const int GRID_UNIT = 2;
+  static const int INDEX_UNIT = 3;
+
+  LightClusters( ) : _lightRows(0), _indexRows(0), _references(0), _dropped(0),
+    _near(0.0f), _far(0.0f), _width(0), _height(0){
+    for(int i = 0; i < 3; i++){
+      _textures[i] = 0;
+    }
+  }
+
+  ~LightClusters( ){
+    if(_textures[0]){
+      glDeleteTextures(3, _textures);
+    }
+  }
+
+  static bool supported( ){
+    return GLEW_VERSION_3_0 || GLEW_ARB_texture_float;
+  }
+
+  void clear( ){
+    _lights.clear( );
+  }
+
+  void add(const PointLight& light){
+    _lights.push_back(light);
+  }
+
+  size_t size( ) const{
+    return _lights.size( );
+  }
+
+  PointLight& operator [](size_t i){
+    return _lights[i];
+  }
+
+  // Bins the lights for a view and uploads the result; projection
+  // must be a symmetric perspective projection with planes near and
+  // far, drawn to a width by height viewport.
+  void update(const glm::mat4& view, const glm::mat4& projection, float near, float far, int width, int height){
+    if(near != _near || far != _far || projection != _projection){
+      _near = near;
+      _far = far;
+      _projection = projection;
+      boundClusters( );
+    }
+    _width = width;
+    _height = height;
+    size_t n = _lights.size( );
+    toEyeSpace(view);
+    findRanges( );
+
+    // Counting sort of (cluster, light) pairs into per-cluster lists
+    _pairs.clear( );
+    for(size_t i = 0; i < n; i++){
+      addPairs(uint32_t(i));
+    }
+    std::fill(_count.begin( ), _count.end( ), 0);
+    for(size_t p = 0; p < _pairs.size( ); p++){
+      _count[_pairs[p].cluster]++;
+    }
+    _dropped = 0;
+    uint32_t offset = 0;
+    for(int c = 0; c < CLUSTERS; c++){
+      uint32_t count = _count[c];
+      if(count > MAX_PER_CLUSTER){
+        _dropped += count - MAX_PER_CLUSTER;
+        count = MAX_PER_CLUSTER;
+      }
+      _grid[4 * c] = float(offset);
+      _grid[4 * c + 1] = float(count);
+      _count[c] = offset;
+      offset += count;
+    }
+    _references = offset;
+    _indices.assign(rowsFor(offset) * TEXTURE_WIDTH, 0.0f);
+    for(size_t p = 0; p < _pairs.size( ); p++){
+      uint32_t c = _pairs[p].cluster;
+      uint32_t end = uint32_t(_grid[4 * c]) + uint32_t(_grid[4 * c + 1]);
+      if(_count[c] < end){
+        _indices[_count[c]++] = float(_pairs[p].light);
+      }
+    }
+    upload( );
+  }
+
+  // Binds the three textures to their units
+  void bind( ){
+    GLStateCache& state = GLStateCache::current( );
+    state.bindTexture(GL_TEXTURE0 + LIGHT_UNIT, GL_TEXTURE_2D, _textures[0]);
+    state.bindTexture(GL_TEXTURE0 + GRID_UNIT, GL_TEXTURE_2D, _textures[1]);
+    state.bindTexture(GL_TEXTURE0 + INDEX_UNIT, GL_TEXTURE_2D, _textures[2]);
+  }
+
+  // clusterScale: tiles per pixel in x and y, then the scale and bias
+  // taking the log of eye space depth to a slice
+  glm::vec4 scale( ) const{
+    float sliceScale = SLICES / log(_far / _near);
+    return glm::vec4(float(TILES_X) / _width, float(TILES_Y) / _height, sliceScale, -log(_near) * sliceScale);
+  }
+
+  // clusterSize: tiles, slices and the width of the textures
+  glm::vec4 dimensions( ) const{
+    return glm::vec4(TILES_X, TILES_Y, SLICES, TEXTURE_WIDTH);
+  }
+
+  // clusterRows: rows of the light, grid and index textures
+  glm::vec4 rows( ) const{
+    return glm::vec4(_lightRows, rowsFor(CLUSTERS), _indexRows, 0.0f);
+  }
+
+  // Entries in all the lists after the last update( )
+  size_t references( ) const{
+    return _references;
+  }
+
+  // Light references left out of full clusters by the last update( )
+  size_t dropped( ) const{
+    return _dropped;
+  }
+
+private:
+  struct Pair{
+    uint32_t cluster;
+    uint32_t light;
+  };
+
+  std::vector<PointLight> _lights;
+  // Eye space centers, structure of arrays padded to four
+  std::vector<float> _x, _y, _z, _radius;
+  // Tile and slice range of each light, inclusive; empty when lo > hi
+  std::vector<int> _tileX0, _tileX1, _tileY0, _tileY1, _slice0, _slice1;
+  // Eye space bounds of every cluster
+  std::vector<glm::vec3> _clusterMin, _clusterMax;
+  std::vector<Pair> _pairs;
+  std::vector<uint32_t> _count;
+  std::vector<float> _grid;
+  std::vector<float> _indices;
+  std::vector<float> _lightData;
+  GLuint _textures[3];
+  int _lightRows;
+  int _indexRows;
+  size_t _references;
+  size_t _dropped;
+  float _near;
+  float _far;
+  glm::mat4 _projection;
+  int _width;
+  int _height;
+
+  static int rowsFor(size_t texels){
+    return std::max(1, int((texels + TEXTURE_WIDTH - 1) / TEXTURE_WIDTH));
+  }
+
+  static int index(int x, int y, int slice){
+    return x + TILES_X * (y + TILES_Y * slice);
+  }
+
+  float sliceDepth(int slice) const{
+    return _near * pow(_far / _near, float(slice) / SLICES);
+  }
+
+  int slice(float depth) const{
+    if(depth <= _near){
+      return 0;
+    }
+    int s = int(floor(log(depth / _near) / log(_far / _near) * SLICES));
+    return std::min(std::max(s, 0), SLICES - 1);
+  }
+
+  // The frustum of a tile widens with depth, so a cluster's box spans
+  // the tile's extent at the slice's far depth.
+  void boundClusters( ){
+    _clusterMin.resize(CLUSTERS);
+    _clusterMax.resize(CLUSTERS);
+    _count.resize(CLUSTERS);
+    _grid.assign(rowsFor(CLUSTERS) * TEXTURE_WIDTH * 4, 0.0f);
+    float sx = 1.0f / _projection[0][0], sy = 1.0f / _projection[1][1];
+    for(int s = 0; s < SLICES; s++){
+      float d0 = sliceDepth(s), d1 = sliceDepth(s + 1);
+      for(int y = 0; y < TILES_Y; y++){
+        float ny0 = 2.0f * y / TILES_Y - 1.0f, ny1 = 2.0f * (y + 1) / TILES_Y - 1.0f;
+        for(int x = 0; x < TILES_X; x++){
+          float nx0 = 2.0f * x / TILES_X - 1.0f, nx1 = 2.0f * (x + 1) / TILES_X - 1.0f;
+          int c = index(x, y, s);
+          _clusterMin[c] = glm::vec3(std::min(nx0 * sx * d0, nx0 * sx * d1), std::min(ny0 * sy * d0, ny0 * sy * d1), -d1);
+          _clusterMax[c] = glm::vec3(std::max(nx1 * sx * d0, nx1 * sx * d1), std::max(ny1 * sy * d0, ny1 * sy * d1), -d0);
+        }
+      }
+    }
+  }
+
+  void toEyeSpace(const glm::mat4& view){
+    size_t n = _lights.size( ), padded = (n + 3) & ~size_t(3);
+    _x.resize(padded);
+    _y.resize(padded);
+    _z.resize(padded);
+    _radius.resize(padded);
+    size_t i = 0;
+#ifdef __SSE__
+    __m128 m[4][4];
+    for(int c = 0; c < 4; c++){
+      for(int r = 0; r < 4; r++){
+        m[c][r] = _mm_set1_ps(view[c][r]);
+      }
+    }
+    for(; i + 4 <= n; i += 4){
+      const PointLight* l = &_lights[i];
+      __m128 x = _mm_setr_ps(l[0].position.x, l[1].position.x, l[2].position.x, l[3].position.x);
+      __m128 y = _mm_setr_ps(l[0].position.y, l[1].position.y, l[2].position.y, l[3].position.y);
+      __m128 z = _mm_setr_ps(l[0].position.z, l[1].position.z, l[2].position.z, l[3].position.z);
+      for(int r = 0; r < 3; r++){
+        __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][r], x), _mm_mul_ps(m[1][r], y)),
+                              _mm_add_ps(_mm_mul_ps(m[2][r], z), m[3][r]));
+        _mm_storeu_ps(&(r == 0 ? _x : r == 1 ? _y : _z)[i], e);
+      }
+      _mm_storeu_ps(&_radius[i], _mm_setr_ps(l[0].radius, l[1].radius, l[2].radius, l[3].radius));
+    }
+#endif
+    for(; i < padded; i++){
+      glm::vec3 e = i < n ? glm::vec3(view * glm::vec4(_lights[i].position, 1.0f)) : glm::vec3(0.0f);
+      _x[i] = e.x;
+      _y[i] = e.y;
+      _z[i] = e.z;
+      _radius[i] = i < n ? _lights[i].radius : 0.0f;
+    }
+  }
+
+  // A sphere's projection is bounded by the x (or y) extent of its box
+  // divided by the nearest and farthest depths of the box.
+  void findRanges( ){
+    size_t padded = _x.size( );
+    _tileX0.resize(padded);
+    _tileX1.resize(padded);
+    _tileY0.resize(padded);
+    _tileY1.resize(padded);
+    _slice0.resize(padded);
+    _slice1.resize(padded);
+    float px = _projection[0][0], py = _projection[1][1];
+    size_t i = 0;
+#ifdef __SSE__
+    const __m128 near = _mm_set1_ps(_near);
+    const __m128 sx = _mm_set1_ps(px), sy = _mm_set1_ps(py);
+    const __m128 halfX = _mm_set1_ps(0.5f * TILES_X), halfY = _mm_set1_ps(0.5f * TILES_Y);
+    const __m128 zero = _mm_setzero_ps( );
+    const __m128 lastX = _mm_set1_ps(TILES_X - 1), lastY = _mm_set1_ps(TILES_Y - 1);
+    for(; i < padded; i += 4){
+      __m128 x = _mm_loadu_ps(&_x[i]), y = _mm_loadu_ps(&_y[i]), r = _mm_loadu_ps(&_radius[i]);
+      __m128 depth = _mm_sub_ps(zero, _mm_loadu_ps(&_z[i]));
+      __m128 nearest = _mm_max_ps(_mm_sub_ps(depth, r), near);
+      __m128 farthest = _mm_max_ps(_mm_add_ps(depth, r), near);
+      __m128 ranges[4];
+      __m128 lo = _mm_mul_ps(sx, _mm_sub_ps(x, r)), hi = _mm_mul_ps(sx, _mm_add_ps(x, r));
+      ranges[0] = _mm_min_ps(_mm_div_ps(lo, nearest), _mm_div_ps(lo, farthest));
+      ranges[1] = _mm_max_ps(_mm_div_ps(hi, nearest), _mm_div_ps(hi, farthest));
+      lo = _mm_mul_ps(sy, _mm_sub_ps(y, r));
+      hi = _mm_mul_ps(sy, _mm_add_ps(y, r));
+      ranges[2] = _mm_min_ps(_mm_div_ps(lo, nearest), _mm_div_ps(lo, farthest));
+      ranges[3] = _mm_max_ps(_mm_div_ps(hi, nearest), _mm_div_ps(hi, farthest));
+      // From normalized device coordinates to tiles; a range wholly off
+      // one side clamps to lo > hi.
+      for(int k = 0; k < 4; k++){
+        __m128 half = k < 2 ? halfX : halfY, last = k < 2 ? lastX : lastY;
+        __m128 tile = _mm_mul_ps(_mm_add_ps(ranges[k], _mm_set1_ps(1.0f)), half);
+        ranges[k] = _mm_min_ps(_mm_max_ps(tile, _mm_set1_ps(-1.0f)), _mm_add_ps(last, _mm_set1_ps(1.0f)));
+      }
+      float t[4][4], d0[4], d1[4];
+      for(int k = 0; k < 4; k++){
+        _mm_storeu_ps(t[k], ranges[k]);
+      }
+      _mm_storeu_ps(d0, _mm_sub_ps(depth, r));
+      _mm_storeu_ps(d1, _mm_add_ps(depth, r));
+      for(int j = 0; j < 4; j++){
+        storeRange(i + j, t[0][j], t[1][j], t[2][j], t[3][j], d0[j], d1[j]);
+      }
+    }
+#endif
+    for(; i < padded; i++){
+      float depth = -_z[i], r = _radius[i];
+      float nearest = std::max(depth - r, _near), farthest = std::max(depth + r, _near);
+      float t[4];
+      float lo = px * (_x[i] - r), hi = px * (_x[i] + r);
+      t[0] = std::min(lo / nearest, lo / farthest);
+      t[1] = std::max(hi / nearest, hi / farthest);
+      lo = py * (_y[i] - r);
+      hi = py * (_y[i] + r);
+      t[2] = std::min(lo / nearest, lo / farthest);
+      t[3] = std::max(hi / nearest, hi / farthest);
+      for(int k = 0; k < 4; k++){
+        float tiles = k < 2 ? TILES_X : TILES_Y;
+        t[k] = std::min(std::max((t[k] + 1.0f) * 0.5f * tiles, -1.0f), tiles);
+      }
+      storeRange(i, t[0], t[1], t[2], t[3], depth - r, depth + r);
+    }
+  }
+
+  void storeRange(size_t i, float x0, float x1, float y0, float y1, float nearest, float farthest){
+    _tileX0[i] = std::max(int(floor(x0)), 0);
+    _tileX1[i] = std::min(int(floor(x1)), TILES_X - 1);
+    _tileY0[i] = std::max(int(floor(y0)), 0);
+    _tileY1[i] = std::min(int(floor(y1)), TILES_Y - 1);
+    if(x1 < 0.0f || x0 >= TILES_X){
+      _tileX0[i] = 1;
+      _tileX1[i] = 0;
+    }
+    if(y1 < 0.0f || y0 >= TILES_Y){
+      _tileY0[i] = 1;
+      _tileY1[i] = 0;
+    }
+    _slice0[i] = slice(nearest);
+    _slice1[i] = farthest > _far ? SLICES - 1 : slice(farthest);
+    if(farthest <= _near || nearest >= _far){
+      _slice0[i] = 1;
+      _slice1[i] = 0;
+    }
+  }
+
+  void addPairs(uint32_t light){
+    Pair pair;
+    pair.light = light;
+    float r = _radius[light];
+    if(r <= 0.0f){
+      for(int c = 0; c < CLUSTERS; c++){
+        pair.cluster = c;
+        _pairs.push_back(pair);
+      }
+      return;
+    }
+    glm::vec3 center(_x[light], _y[light], _z[light]);
+    for(int s = _slice0[light]; s <= _slice1[light]; s++){
+      for(int y = _tileY0[light]; y <= _tileY1[light]; y++){
+        for(int x = _tileX0[light]; x <= _tileX1[light]; x++){
+          int c = index(x, y, s);
+          glm::vec3 d = center - glm::clamp(center, _clusterMin[c], _clusterMax[c]);
+          if(d.x * d.x + d.y * d.y + d.z * d.z <= r * r){
+            pair.cluster = c;
+            _pairs.push_back(pair);
+          }
+        }
+      }
+    }
+  }
+
+  void upload( ){
+    GLStateCache& state = GLStateCache::current( );
+    if(!_textures[0]){
+      glGenTextures(3, _textures);
+      for(int i = 0; i < 3; i++){
+        state.bindTexture(GL_TEXTURE0 + LIGHT_UNIT + i, GL_TEXTURE_2D, _textures[i]);
+        state.activeTexture(GL_TEXTURE0 + LIGHT_UNIT + i);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      }
+      state.bindTexture(GL_TEXTURE0 + GRID_UNIT, GL_TEXTURE_2D, _textures[1]);
+      state.activeTexture(GL_TEXTURE0 + GRID_UNIT);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, TEXTURE_WIDTH, rowsFor(CLUSTERS), 0, GL_RGBA, GL_FLOAT, NULL);
+    }
+
+    size_t n = _lights.size( );
+    _lightData.assign(rowsFor(2 * n) * TEXTURE_WIDTH * 4, 0.0f);
+    for(size_t i = 0; i < n; i++){
+      float* texel = &_lightData[8 * i];
+      texel[0] = _x[i];
+      texel[1] = _y[i];
+      texel[2] = _z[i];
+      texel[3] = _radius[i];
+      texel[4] = _lights[i].color.r;
+      texel[5] = _lights[i].color.g;
+      texel[6] = _lights[i].color.b;
+      texel[7] = _lights[i].color.a;
+    }
+    state.bindTexture(GL_TEXTURE0 + LIGHT_UNIT, GL_TEXTURE_2D, _textures[0]);
+    state.activeTexture(GL_TEXTURE0 + LIGHT_UNIT);
+    if(rowsFor(2 * n) != _lightRows){
+      _lightRows = rowsFor(2 * n);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, TEXTURE_WIDTH, _lightRows, 0, GL_RGBA, GL_FLOAT, &_lightData[0]);
+    }else{
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TEXTURE_WIDTH, _lightRows, GL_RGBA, GL_FLOAT, &_lightData[0]);
+    }
+
+    state.bindTexture(GL_TEXTURE0 + GRID_UNIT, GL_TEXTURE_2D, _textures[1]);
+    state.activeTexture(GL_TEXTURE0 + GRID_UNIT);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TEXTURE_WIDTH, rowsFor(CLUSTERS), GL_RGBA, GL_FLOAT, &_grid[0]);
+
+    // One channel textures are GL_R32F from OpenGL 3.0 or
+    // ARB_texture_rg on, luminance before.
+    bool red = GLEW_VERSION_3_0 || GLEW_ARB_texture_rg;
+    GLenum format = red ? GL_RED : GL_LUMINANCE;
+    state.bindTexture(GL_TEXTURE0 + INDEX_UNIT, GL_TEXTURE_2D, _textures[2]);
+    state.activeTexture(GL_TEXTURE0 + INDEX_UNIT);
+    // The index texture only grows, so reallocation stops after the
+    // busiest frames.
+    int indexRows = rowsFor(_references);
+    if(indexRows > _indexRows){
+      _indexRows = indexRows;
+      _indices.resize(_indexRows * TEXTURE_WIDTH, 0.0f);
+      glTexImage2D(GL_TEXTURE_2D, 0, red ? GL_R32F : GL_LUMINANCE32F_ARB, TEXTURE_WIDTH, _indexRows, 0, format, GL_FLOAT, &_indices[0]);
+    }else{
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TEXTURE_WIDTH, indexRows, format, GL_FLOAT, &_indices[0]);
+    }
+  }
+
+  LightClusters(const LightClusters&);
+  LightClusters& operator=(const LightClusters&);
+};
+
+#endif
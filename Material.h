@@ -7,6 +7,8 @@
 //
 
 #include <iostream>
+#include <vector>
+#include <cassert>
 #include <glm/vec3.hpp>
 
 #ifndef _MATERIAL_H_
@@ -31,4 +33,47 @@ public:
 
 };
 
+// A palette of materials referred to by index. Instanced draws carry
+// the index per instance and the shader looks the material up, so
+// the palette size is bounded by the shader's uniform budget.
+class MaterialLibrary{
+public:
+  // Must match MAX_MATERIALS in blinn_phong_instanced.vert.glsl
+  static const int MAX_MATERIALS = 32;
+
+  MaterialLibrary( ){ }
+
+  ~MaterialLibrary( ){
+    clear( );
+  }
+
+  // Takes ownership of m and returns its index.
+  int add(Material* m){
+    assert(size( ) < MAX_MATERIALS);
+    _materials.push_back(m);
+    return size( ) - 1;
+  }
+
+  Material* operator[](int i){
+    return _materials[i];
+  }
+
+  int size( ) const{
+    return int(_materials.size( ));
+  }
+
+  void clear( ){
+    for(size_t i = 0; i < _materials.size( ); i++){
+      delete _materials[i];
+    }
+    _materials.clear( );
+  }
+
+private:
+  std::vector<Material*> _materials;
+
+  MaterialLibrary(const MaterialLibrary&);
+  MaterialLibrary& operator=(const MaterialLibrary&);
+};
+
 #endif
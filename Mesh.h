@@ -0,0 +1,113 @@
+//
+// A retained-mode indexed triangle mesh.
+//
+// The vertices are interleaved position, normal and texture
+// coordinate and are uploaded once into a vertex buffer. The
+// vertex array object records the generic attribute bindings
+// so drawing is a bind plus a single glDrawElements.
+//
+//
+
+#include <cstddef>
+#include <GL/glew.h>
+
+#include "GLStateCache.h"
+
+#ifndef _MESH_H_
+#define _MESH_H_
+
+// Generic vertex attribute locations shared by every shader program.
+// They are bound by name with GLSLProgram::bindAttribLocation before
+// the program is linked.
+enum VertexAttribute{
+  ATTRIB_POSITION = 0,
+  ATTRIB_NORMAL = 1,
+  ATTRIB_TEXCOORD = 2,
+  // Per-instance attributes, see InstanceBatch.h
+  ATTRIB_INSTANCE_POSITION = 3,
+  ATTRIB_INSTANCE_SCALE = 4,
+  ATTRIB_INSTANCE_PARAMS = 5,
+  ATTRIB_INSTANCE_TEXRECT = 6
+};
+
+struct Vertex{
+  float position[3];
+  float normal[3];
+  float texCoord[2];
+};
+
+class Mesh{
+public:
+  Mesh( ) : _vao(0), _vbo(0), _ebo(0), _indexCount(0){ }
+
+  ~Mesh( ){
+    if(_vao){
+      // Keep the state cache from holding a name that may be reused
+      GLStateCache::current( ).bindVertexArray(0);
+      glDeleteVertexArrays(1, &_vao);
+      glDeleteBuffers(1, &_vbo);
+      glDeleteBuffers(1, &_ebo);
+    }
+  }
+
+  void upload(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount){
+    if(!_vao){
+      glGenVertexArrays(1, &_vao);
+      glGenBuffers(1, &_vbo);
+      glGenBuffers(1, &_ebo);
+    }
+    GLStateCache& state = GLStateCache::current( );
+    state.bindVertexArray(_vao);
+    state.bindBuffer(GL_ARRAY_BUFFER, _vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+    // The element array binding is part of the vertex array object's state.
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), indices, GL_STATIC_DRAW);
+
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+    glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+    glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+
+    state.bindVertexArray(0);
+    state.bindBuffer(GL_ARRAY_BUFFER, 0);
+    _indexCount = (GLsizei)indexCount;
+  }
+
+  void bind( ){
+    GLStateCache::current( ).bindVertexArray(_vao);
+  }
+
+  void unbind( ){
+    GLStateCache::current( ).bindVertexArray(0);
+  }
+
+  // Leaves the vertex array bound; drawing the same mesh again costs
+  // no rebind.
+  void draw( ){
+    bind( );
+    glDrawElements(GL_TRIANGLES, _indexCount, GL_UNSIGNED_INT, 0);
+  }
+
+  GLuint vao( ){
+    return _vao;
+  }
+
+  GLsizei indexCount( ){
+    return _indexCount;
+  }
+
+private:
+  GLuint _vao;
+  GLuint _vbo;
+  GLuint _ebo;
+  GLsizei _indexCount;
+
+  // A mesh owns GL names; copies would delete them twice.
+  Mesh(const Mesh&);
+  Mesh& operator=(const Mesh&);
+};
+
+#endif
@@ -0,0 +1,183 @@
+//
+// Normal matrices computed by the cheapest method that is exact for
+// the matrix at hand.
+//
+// The normal matrix is the inverse transpose of the model view
+// matrix, but only its upper 3x3 acts on a normal (w is 0), and for
+// most of what is drawn that block is far simpler than a general
+// 4x4 inverse assumes. classify( ) sorts a matrix into one of
+//
+//   TRANSLATION    the 3x3 block is the identity; so is the result
+//   UNIFORM_SCALE  a rotation times a uniform scale s; the result is
+//                  the 3x3 block divided by s * s
+//   AFFINE         any other 3x3 block with a (0, 0, 0, 1) bottom
+//                  row; the result's columns are the cross products
+//                  of pairs of columns over the determinant
+//   GENERAL        a projective bottom row; a full 4x4 inverse and
+//                  transpose
+//
+// The first three leave the translation out, which changes nothing
+// for a normal. compute( ) over an array runs each class with glm's
+// SSE kernels in glm/simd/ when GLM_ARCH has SSE2, one matrix per
+// set of registers, and counts how many matrices fell in each class.
+//
+//
+
+#include <cmath>
+#include <cstddef>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/geometric.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/simd/matrix.h>
+
+#ifndef _NORMAL_MATRICES_H_
+#define _NORMAL_MATRICES_H_
+
+class NormalMatrices{
+public:
+  enum Kind{
+    TRANSLATION,
+    UNIFORM_SCALE,
+    AFFINE,
+    GENERAL,
+    KIND_COUNT
+  };
+
+  NormalMatrices( ){
+    resetCounts( );
+  }
+
+  static Kind classify(const glm::mat4& m){
+    if(m[0][3] != 0.0f || m[1][3] != 0.0f || m[2][3] != 0.0f || m[3][3] != 1.0f){
+      return GENERAL;
+    }
+    glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+    float l0 = glm::dot(c0, c0);
+    float l1 = glm::dot(c1, c1);
+    float l2 = glm::dot(c2, c2);
+    // Relative to the squared scale, so tiny and huge scales classify
+    // alike
+    float tolerance = 1e-5f * l0;
+    if(std::fabs(l0 - l1) > tolerance || std::fabs(l0 - l2) > tolerance ||
+       std::fabs(glm::dot(c0, c1)) > tolerance || std::fabs(glm::dot(c1, c2)) > tolerance ||
+       std::fabs(glm::dot(c2, c0)) > tolerance || l0 == 0.0f){
+      return AFFINE;
+    }
+    if(c0 == glm::vec3(1.0f, 0.0f, 0.0f) && c1 == glm::vec3(0.0f, 1.0f, 0.0f) && c2 == glm::vec3(0.0f, 0.0f, 1.0f)){
+      return TRANSLATION;
+    }
+    return UNIFORM_SCALE;
+  }
+
+  // The normal matrix of m, which is of kind k
+  static glm::mat4 compute(const glm::mat4& m, Kind k){
+    glm::vec4 w(0.0f, 0.0f, 0.0f, 1.0f);
+    switch(k){
+    case TRANSLATION:
+      return glm::mat4(1.0f);
+    case UNIFORM_SCALE:{
+      float s2 = 1.0f / glm::dot(glm::vec3(m[0]), glm::vec3(m[0]));
+      return glm::mat4(m[0] * s2, m[1] * s2, m[2] * s2, w);
+    }
+    case AFFINE:{
+      glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+      glm::vec3 x = glm::cross(c1, c2);
+      float d = 1.0f / glm::dot(c0, x);
+      return glm::mat4(glm::vec4(x * d, 0.0f), glm::vec4(glm::cross(c2, c0) * d, 0.0f),
+                       glm::vec4(glm::cross(c0, c1) * d, 0.0f), w);
+    }
+    default:
+      return glm::inverseTranspose(m);
+    }
+  }
+
+  static glm::mat4 compute(const glm::mat4& m){
+    return compute(m, classify(m));
+  }
+
+  // Writes the normal matrix of each of the count matrices in in to
+  // out; the two may be the same array.
+  void compute(const glm::mat4* in, glm::mat4* out, size_t count){
+    for(size_t i = 0; i < count; i++){
+      Kind k = classify(in[i]);
+      _counts[k]++;
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+      computeSSE(in[i], out[i], k);
+#else
+      out[i] = compute(in[i], k);
+#endif
+    }
+  }
+
+  // Matrices of kind k handed to compute( ) since resetCounts( )
+  unsigned int count(Kind k) const{
+    return _counts[k];
+  }
+
+  void resetCounts( ){
+    for(int k = 0; k < KIND_COUNT; k++){
+      _counts[k] = 0;
+    }
+  }
+
+  static const char* name(Kind k){
+    static const char* names[KIND_COUNT] = {"translation", "uniform scale", "affine", "general"};
+    return names[k];
+  }
+
+private:
+  unsigned int _counts[KIND_COUNT];
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+  // glm::mat4 is not 16 byte aligned unless GLM_FORCE_ALIGNED, so
+  // columns are loaded and stored unaligned. The pointers are to the
+  // whole matrix; &m[0][0] points to a single float, and GCC assumes
+  // what is read through it ends there.
+  static void computeSSE(const glm::mat4& m, glm::mat4& n, Kind k){
+    const float* p = reinterpret_cast<const float*>(&m);
+    float* q = reinterpret_cast<float*>(&n);
+    glm_vec4 c[4], r[4];
+    c[0] = _mm_loadu_ps(p);
+    c[1] = _mm_loadu_ps(p + 4);
+    c[2] = _mm_loadu_ps(p + 8);
+    c[3] = _mm_loadu_ps(p + 12);
+    r[3] = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    switch(k){
+    case TRANSLATION:
+      r[0] = _mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f);
+      r[1] = _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f);
+      r[2] = _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f);
+      break;
+    case UNIFORM_SCALE:{
+      glm_vec4 s2 = _mm_div_ps(_mm_set1_ps(1.0f), glm_vec4_dot(c[0], c[0]));
+      r[0] = _mm_mul_ps(c[0], s2);
+      r[1] = _mm_mul_ps(c[1], s2);
+      r[2] = _mm_mul_ps(c[2], s2);
+      break;
+    }
+    case AFFINE:{
+      glm_vec4 x = glm_vec4_cross(c[1], c[2]);
+      glm_vec4 d = _mm_div_ps(_mm_set1_ps(1.0f), glm_vec4_dot(c[0], x));
+      r[0] = _mm_mul_ps(x, d);
+      r[1] = _mm_mul_ps(glm_vec4_cross(c[2], c[0]), d);
+      r[2] = _mm_mul_ps(glm_vec4_cross(c[0], c[1]), d);
+      break;
+    }
+    default:{
+      glm_vec4 inverse[4];
+      glm_mat4_inverse(c, inverse);
+      glm_mat4_transpose(inverse, r);
+      break;
+    }
+    }
+    _mm_storeu_ps(q, r[0]);
+    _mm_storeu_ps(q + 4, r[1]);
+    _mm_storeu_ps(q + 8, r[2]);
+    _mm_storeu_ps(q + 12, r[3]);
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,177 @@
+//
+// An on-disk cache of linked shader program binaries.
+//
+// Compiling and linking GLSL at every start is the bulk of start up
+// time once there are several programs. After a program links,
+// store( ) saves what glGetProgramBinary returns under the cache
+// directory; on the next run load( ) hands the saved binary to
+// glProgramBinary and the compiler is not run at all.
+//
+// A binary is named by a 64-bit FNV-1a hash of everything that went
+// into it: the shader sources, any defines, the attribute bindings,
+// and the vendor, renderer and version strings of the driver, so a
+// driver update or an edited shader simply misses. A driver may still
+// reject a binary it wrote itself; load( ) then returns false and the
+// caller compiles as usual and stores over the stale file.
+//
+//
+
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <GL/glew.h>
+
+#ifndef _PROGRAM_CACHE_H_
+#define _PROGRAM_CACHE_H_
+
+class ProgramCache{
+public:
+  ProgramCache(const std::string& directory = "shader_cache") :
+    _directory(directory), _hits(0), _misses(0){ }
+
+  // Needs OpenGL 4.1 or ARB_get_program_binary and at least one binary
+  // format; some drivers expose the entry points but no formats.
+  static bool supported( ){
+    if(!(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)){
+      return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+  }
+
+  // Starts a key; add( ) every source, define or binding that affects
+  // the linked program.
+  uint64_t begin( ) const{
+    uint64_t h = FNV_OFFSET;
+    const GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for(int i = 0; i < 3; i++){
+      const char* s = (const char*)glGetString(strings[i]);
+      h = add(h, s ? s : "");
+    }
+    return h;
+  }
+
+  static uint64_t add(uint64_t h, const std::string& s){
+    for(size_t i = 0; i < s.size( ); i++){
+      h = (h ^ (unsigned char)s[i]) * FNV_PRIME;
+    }
+    // A separator, so ("ab", "c") and ("a", "bc") differ
+    h = (h ^ 0xff) * FNV_PRIME;
+    return h;
+  }
+
+  // Call before glLinkProgram so the driver keeps a binary to return.
+  static void prepare(GLuint program){
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  // Replaces program with the binary stored under key; false when
+  // there is none or the driver no longer accepts it.
+  bool load(GLuint program, uint64_t key){
+    std::string path = filename(key);
+    FILE* in = fopen(path.c_str( ), "rb");
+    if(!in){
+      _misses++;
+      return false;
+    }
+    Header header;
+    std::vector<char> binary;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+              header.magic == MAGIC && header.key == key && header.length > 0;
+    if(ok){
+      binary.resize(header.length);
+      ok = fread(&binary[0], 1, binary.size( ), in) == binary.size( );
+    }
+    fclose(in);
+    GLint linked = GL_FALSE;
+    if(ok){
+      glProgramBinary(program, header.format, &binary[0], GLsizei(binary.size( )));
+      glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+    if(!linked){
+      _misses++;
+      return false;
+    }
+    _hits++;
+    return true;
+  }
+
+  // Saves the binary of a successfully linked program under key.
+  bool store(GLuint program, uint64_t key){
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0){
+      return false;
+    }
+    Header header;
+    header.magic = MAGIC;
+    header.key = key;
+    header.reserved = 0;
+    std::vector<char> binary(length);
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &header.format, &binary[0]);
+    if(written <= 0){
+      return false;
+    }
+    header.length = uint32_t(written);
+    if(mkdir(_directory.c_str( ), 0755) != 0 && errno != EEXIST){
+      fprintf(stderr, "ProgramCache: can't create %s\n", _directory.c_str( ));
+      return false;
+    }
+    // Written aside and renamed so a concurrent or interrupted run
+    // never reads half a file.
+    std::string path = filename(key);
+    std::string temporary = path + ".tmp";
+    FILE* out = fopen(temporary.c_str( ), "wb");
+    if(!out){
+      fprintf(stderr, "ProgramCache: can't write %s\n", temporary.c_str( ));
+      return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(&binary[0], 1, header.length, out) == header.length;
+    ok = fclose(out) == 0 && ok;
+    if(!ok || rename(temporary.c_str( ), path.c_str( )) != 0){
+      fprintf(stderr, "ProgramCache: can't write %s\n", path.c_str( ));
+      remove(temporary.c_str( ));
+      return false;
+    }
+    return true;
+  }
+
+  unsigned int hits( ) const{
+    return _hits;
+  }
+
+  unsigned int misses( ) const{
+    return _misses;
+  }
+
+private:
+  static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+  static const uint64_t FNV_PRIME = 1099511628211ULL;
+  static const uint32_t MAGIC = 0x42505347; // "GSPB"
+
+  struct Header{
+    uint32_t magic;
+    GLenum format;
+    uint64_t key;
+    uint32_t length;
+    uint32_t reserved;
+  };
+
+  std::string _directory;
+  unsigned int _hits;
+  unsigned int _misses;
+
+  std::string filename(uint64_t key) const{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+    return _directory + name;
+  }
+};
+
+#endif
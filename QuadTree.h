@@ -0,0 +1,276 @@
+//
+// A quadtree over bounding boxes, shared by collision detection
+// and view frustum culling.
+//
+// The tree divides boxes into quadrants of the xy plane by their
+// centers, so every box lives in exactly one node, and each node
+// keeps the tight 3D bounds of everything beneath it. The boxes of
+// a subtree are a contiguous range of the item array, so a subtree
+// wholly inside the frustum is accepted without visiting it, and
+// one wholly outside is rejected with a single test. Culling costs
+// about O(visible + log n). The tree keeps its own copy of the boxes
+// in item order, so the boxes of a leaf across the frustum's edge are
+// contiguous and tested four at a time by Frustum::cull.
+//
+// Moving boxes keep the tree's shape with refit( ), which only
+// recomputes the node bounds and the copy; build( ) again when they
+// have moved far.
+//
+//
+
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <glm/vec3.hpp>
+#include <glm/common.hpp>
+
+#include "Frustum.h"
+
+#ifndef _QUAD_TREE_H_
+#define _QUAD_TREE_H_
+
+class QuadTree{
+public:
+  // Nodes with no more than leafSize boxes are not divided.
+  QuadTree(size_t leafSize = 8) : _leafSize(leafSize){ }
+
+  void build(const AABBBatch& boxes){
+    _nodes.clear( );
+    _items.resize(boxes.size( ));
+    for(size_t i = 0; i < _items.size( ); i++){
+      _items[i] = uint32_t(i);
+    }
+    if(!_items.empty( )){
+      buildNode(boxes, 0, _items.size( ), 0);
+    }
+    copyBoxes(boxes);
+    _visible.resize(_items.size( ));
+  }
+
+  // Updates the node bounds for boxes that have moved; the boxes must
+  // be the ones the tree was built from, in the same order.
+  void refit(const AABBBatch& boxes){
+    copyBoxes(boxes);
+    // Children are always stored after their parent.
+    for(size_t n = _nodes.size( ); n-- > 0;){
+      Node& node = _nodes[n];
+      if(isLeaf(node)){
+        bound(boxes, node);
+      }else{
+        node.min = glm::vec3(FLT_MAX);
+        node.max = glm::vec3(-FLT_MAX);
+        for(int c = 0; c < 4; c++){
+          if(node.child[c] >= 0){
+            node.min = glm::min(node.min, _nodes[node.child[c]].min);
+            node.max = glm::max(node.max, _nodes[node.child[c]].max);
+          }
+        }
+      }
+    }
+  }
+
+  size_t nodeCount( ) const{
+    return _nodes.size( );
+  }
+
+  // Calls visit(i, j) once for every pair of boxes that overlap.
+  template<typename Visitor>
+  void forEachOverlappingPair(const AABBBatch& boxes, Visitor visit) const{
+    if(!_nodes.empty( )){
+      selfPairs(boxes, 0, visit);
+    }
+  }
+
+  // Appends the index of every box that may be inside frustum, as of
+  // the last build( ) or refit( ).
+  void cull(const Frustum& frustum, std::vector<uint32_t>& visible) const{
+    if(!_nodes.empty( )){
+      cullNode(frustum, 0, visible);
+    }
+  }
+
+private:
+  static const int MAX_DEPTH = 16;
+
+  struct Node{
+    glm::vec3 min;
+    glm::vec3 max;
+    // Range of _items below this node
+    uint32_t first;
+    uint32_t count;
+    // Indices into _nodes, -1 for an empty quadrant; all -1 in a leaf
+    int32_t child[4];
+  };
+
+  size_t _leafSize;
+  std::vector<Node> _nodes;
+  std::vector<uint32_t> _items;
+  // The boxes in the order of _items
+  AABBBatch _sorted;
+  // Frustum::cull's results for a leaf
+  mutable std::vector<unsigned char> _visible;
+
+  void copyBoxes(const AABBBatch& boxes){
+    _sorted.clear( );
+    for(size_t i = 0; i < _items.size( ); i++){
+      _sorted.add(boxes.center(_items[i]), boxes.halfExtent(_items[i]));
+    }
+  }
+
+  static bool isLeaf(const Node& node){
+    return node.child[0] < 0 && node.child[1] < 0 && node.child[2] < 0 && node.child[3] < 0;
+  }
+
+  static bool overlap(const glm::vec3& aMin, const glm::vec3& aMax, const glm::vec3& bMin, const glm::vec3& bMax){
+    return aMin.x <= bMax.x && bMin.x <= aMax.x &&
+           aMin.y <= bMax.y && bMin.y <= aMax.y &&
+           aMin.z <= bMax.z && bMin.z <= aMax.z;
+  }
+
+  static bool overlap(const AABBBatch& boxes, uint32_t a, uint32_t b){
+    glm::vec3 ca = boxes.center(a), ea = boxes.halfExtent(a);
+    glm::vec3 cb = boxes.center(b), eb = boxes.halfExtent(b);
+    return overlap(ca - ea, ca + ea, cb - eb, cb + eb);
+  }
+
+  void bound(const AABBBatch& boxes, Node& node) const{
+    node.min = glm::vec3(FLT_MAX);
+    node.max = glm::vec3(-FLT_MAX);
+    for(uint32_t i = node.first; i < node.first + node.count; i++){
+      glm::vec3 c = boxes.center(_items[i]), e = boxes.halfExtent(_items[i]);
+      node.min = glm::min(node.min, c - e);
+      node.max = glm::max(node.max, c + e);
+    }
+  }
+
+  struct Below{
+    const AABBBatch* boxes;
+    int axis;
+    float split;
+    bool operator ()(uint32_t i) const{
+      return boxes->center(i)[axis] < split;
+    }
+  };
+
+  int buildNode(const AABBBatch& boxes, size_t first, size_t count, int depth){
+    int index = int(_nodes.size( ));
+    _nodes.push_back(Node( ));
+    Node node;
+    node.first = uint32_t(first);
+    node.count = uint32_t(count);
+    for(int c = 0; c < 4; c++){
+      node.child[c] = -1;
+    }
+    bound(boxes, node);
+    if(count > _leafSize && depth < MAX_DEPTH){
+      // Split at the middle of the centers so a cluster of small boxes
+      // is divided even inside a large node.
+      glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+      for(size_t i = first; i < first + count; i++){
+        lo = glm::min(lo, boxes.center(_items[i]));
+        hi = glm::max(hi, boxes.center(_items[i]));
+      }
+      if(lo.x < hi.x || lo.y < hi.y){
+        glm::vec3 mid = 0.5f * (lo + hi);
+        std::vector<uint32_t>::iterator begin = _items.begin( ) + first, end = begin + count;
+        Below left = {&boxes, 0, mid.x};
+        std::vector<uint32_t>::iterator xSplit = std::partition(begin, end, left);
+        Below lowY = {&boxes, 1, mid.y};
+        std::vector<uint32_t>::iterator bounds[5] = {begin, std::partition(begin, xSplit, lowY), xSplit, std::partition(xSplit, end, lowY), end};
+        for(int c = 0; c < 4; c++){
+          if(bounds[c] != bounds[c + 1]){
+            node.child[c] = buildNode(boxes, bounds[c] - _items.begin( ), bounds[c + 1] - bounds[c], depth + 1);
+          }
+        }
+      }
+    }
+    _nodes[index] = node;
+    return index;
+  }
+
+  template<typename Visitor>
+  void selfPairs(const AABBBatch& boxes, int n, Visitor& visit) const{
+    const Node& node = _nodes[n];
+    if(isLeaf(node)){
+      for(uint32_t i = node.first; i < node.first + node.count; i++){
+        for(uint32_t j = i + 1; j < node.first + node.count; j++){
+          if(overlap(boxes, _items[i], _items[j])){
+            visit(_items[i], _items[j]);
+          }
+        }
+      }
+      return;
+    }
+    for(int a = 0; a < 4; a++){
+      if(node.child[a] < 0){
+        continue;
+      }
+      selfPairs(boxes, node.child[a], visit);
+      for(int b = a + 1; b < 4; b++){
+        if(node.child[b] >= 0){
+          crossPairs(boxes, node.child[a], node.child[b], visit);
+        }
+      }
+    }
+  }
+
+  template<typename Visitor>
+  void crossPairs(const AABBBatch& boxes, int a, int b, Visitor& visit) const{
+    const Node& na = _nodes[a];
+    const Node& nb = _nodes[b];
+    if(!overlap(na.min, na.max, nb.min, nb.max)){
+      return;
+    }
+    bool leafA = isLeaf(na), leafB = isLeaf(nb);
+    if(leafA && leafB){
+      for(uint32_t i = na.first; i < na.first + na.count; i++){
+        for(uint32_t j = nb.first; j < nb.first + nb.count; j++){
+          if(overlap(boxes, _items[i], _items[j])){
+            visit(_items[i], _items[j]);
+          }
+        }
+      }
+    }else if(leafA || (!leafB && nb.count > na.count)){
+      for(int c = 0; c < 4; c++){
+        if(nb.child[c] >= 0){
+          crossPairs(boxes, a, nb.child[c], visit);
+        }
+      }
+    }else{
+      for(int c = 0; c < 4; c++){
+        if(na.child[c] >= 0){
+          crossPairs(boxes, na.child[c], b, visit);
+        }
+      }
+    }
+  }
+
+  void cullNode(const Frustum& frustum, int n, std::vector<uint32_t>& visible) const{
+    const Node& node = _nodes[n];
+    Frustum::containment_t c = frustum.classify(0.5f * (node.min + node.max), 0.5f * (node.max - node.min));
+    if(c == Frustum::OUTSIDE){
+      return;
+    }
+    if(c == Frustum::INSIDE){
+      visible.insert(visible.end( ), _items.begin( ) + node.first, _items.begin( ) + node.first + node.count);
+      return;
+    }
+    if(isLeaf(node)){
+      frustum.cull(_sorted, node.first, node.count, &_visible[0]);
+      for(uint32_t i = 0; i < node.count; i++){
+        if(_visible[i]){
+          visible.push_back(_items[node.first + i]);
+        }
+      }
+      return;
+    }
+    for(int k = 0; k < 4; k++){
+      if(node.child[k] >= 0){
+        cullNode(frustum, node.child[k], visible);
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,361 @@
+//
+// Shader programs specialized at compile time by #defines.
+//
+// The Blinn-Phong shaders are written once with their optional work
+// behind preprocessor switches: LIGHT_COUNT point lights, TEXTURED
+// for the texture lookup and CLUSTERED for the clustered lights of
+// LightClusters.h. A ShaderKey names one combination
+// of those plus whether the program draws instances, which selects
+// the source files. ShaderVariants compiles the program for a key the
+// first time it is asked for, so only the combinations a scene
+// actually draws are ever built, and a draw whose image is plain
+// white or whose scene has one light does not pay for the rest.
+//
+// Each variant carries its own uniform locations in a Uniforms
+// struct, which must provide locate(GLuint program, const ShaderKey&).
+//
+// reload( ) rebuilds every variant made from a changed source file
+// without stopping the frame: the new program compiles and links
+// beside the old one, in the background where the driver has
+// ARB_parallel_shader_compile, and update( ) swaps it in once it has
+// linked. A program that fails to build is dropped and the old one
+// keeps drawing.
+//
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <GL/glew.h>
+
+#include "GLSLShader.h"
+#include "Mesh.h"
+#include "ProgramCache.h"
+#include "utilities.h"
+
+#ifndef _SHADER_VARIANT_H_
+#define _SHADER_VARIANT_H_
+
+struct ShaderKey{
+  static const unsigned int MAX_LIGHTS = 2;
+  // Number of distinct keys; index( ) is below this.
+  static const unsigned int COUNT = (MAX_LIGHTS + 1) * 8;
+
+  unsigned int lights;
+  bool textured;
+  bool instanced;
+  bool clustered;
+
+  explicit ShaderKey(unsigned int lights = MAX_LIGHTS, bool textured = true, bool instanced = false, bool clustered = false) :
+    lights(lights > MAX_LIGHTS ? MAX_LIGHTS : lights), textured(textured), instanced(instanced), clustered(clustered){ }
+
+  // A small dense number for the key, also usable as the program
+  // field of a DrawList key.
+  unsigned int index( ) const{
+    return lights * 8 + (clustered ? 4 : 0) + (textured ? 2 : 0) + (instanced ? 1 : 0);
+  }
+
+  static ShaderKey fromIndex(unsigned int index){
+    return ShaderKey(index / 8, (index & 2) != 0, (index & 1) != 0, (index & 4) != 0);
+  }
+
+  std::string defines( ) const{
+    char text[96];
+    snprintf(text, sizeof(text), "#define LIGHT_COUNT %u\n#define TEXTURED %d\n#define CLUSTERED %d\n",
+             lights, textured ? 1 : 0, clustered ? 1 : 0);
+    return text;
+  }
+
+  // For messages, e.g. "2 lights, textured"
+  std::string describe( ) const{
+    char text[64];
+    snprintf(text, sizeof(text), "%u lights%s, %s", lights, clustered ? " and clustered lights" : "",
+             textured ? "textured" : "untextured");
+    return text;
+  }
+
+  bool operator ==(const ShaderKey& other) const{
+    return index( ) == other.index( );
+  }
+};
+
+template<typename Uniforms>
+struct ShaderVariant{
+  ShaderKey key;
+  GLSLProgram program;
+  Uniforms uniforms;
+
+  GLuint id( ){
+    return program.id( );
+  }
+};
+
+template<typename Uniforms>
+class ShaderVariants{
+public:
+  ShaderVariants( ) : _cache(NULL), _variants(ShaderKey::COUNT, (ShaderVariant<Uniforms>*)NULL), _count(0){ }
+
+  ~ShaderVariants( ){
+    clear( );
+  }
+
+  // Linked variants are looked up in and saved to cache when it is
+  // not NULL.
+  void setProgramCache(ProgramCache* cache){
+    _cache = cache;
+  }
+
+  // The vertex and fragment shader files for instanced or for
+  // per-object variants; changing them drops the variants built so far.
+  void setSources(bool instanced, const std::string& vertexFile, const std::string& fragmentFile){
+    clear( );
+    _vertexFile[instanced] = vertexFile;
+    _fragmentFile[instanced] = fragmentFile;
+  }
+
+  // Whether file is one of the sources of any variant
+  bool uses(const std::string& file) const{
+    return file == _vertexFile[0] || file == _fragmentFile[0] ||
+           file == _vertexFile[1] || file == _fragmentFile[1];
+  }
+
+  // Starts rebuilding every variant compiled from file; returns how
+  // many. A rebuild already under way for a variant is abandoned.
+  size_t reload(const std::string& file){
+    size_t n = 0;
+    for(size_t i = 0; i < _variants.size( ); i++){
+      ShaderVariant<Uniforms>* variant = _variants[i];
+      if(!variant){
+        continue;
+      }
+      bool instanced = variant->key.instanced;
+      if(file != _vertexFile[instanced] && file != _fragmentFile[instanced]){
+        continue;
+      }
+      cancel(i);
+      Pending pending;
+      pending.index = i;
+      pending.start = seconds( );
+      pending.program = new GLSLProgram( );
+      std::string defines = variant->key.defines( );
+      std::string vertexSource = injectDefines(readSource(_vertexFile[instanced]), defines);
+      std::string fragmentSource = injectDefines(readSource(_fragmentFile[instanced]), defines);
+      pending.key = _cache ? cacheKey(vertexSource, fragmentSource) : 0;
+      pending.vertexShader = new VertexShader(_vertexFile[instanced].c_str( ), vertexSource, false);
+      pending.fragmentShader = new FragmentShader(_fragmentFile[instanced].c_str( ), fragmentSource, false);
+      pending.program->attach(*pending.vertexShader);
+      pending.program->attach(*pending.fragmentShader);
+      bindAttributes(*pending.program);
+      if(_cache){
+        ProgramCache::prepare(pending.program->id( ));
+      }
+      pending.program->startLink( );
+      _pending.push_back(pending);
+      n++;
+    }
+    return n;
+  }
+
+  // Swaps in the rebuilt programs that have finished linking and
+  // appends their keys to swapped; failed ones are reported and
+  // dropped. Call once a frame; returns how many were swapped in.
+  size_t update(std::vector<ShaderKey>& swapped){
+    size_t n = 0;
+    for(size_t p = 0; p < _pending.size( );){
+      Pending& pending = _pending[p];
+      if(!pending.program->ready( )){
+        p++;
+        continue;
+      }
+      ShaderVariant<Uniforms>& variant = *_variants[pending.index];
+      bool instanced = variant.key.instanced;
+      bool ok = pending.vertexShader->compiled( ) && pending.fragmentShader->compiled( ) && pending.program->linked( );
+      if(ok){
+        if(_cache){
+          _cache->store(pending.program->id( ), pending.key);
+        }
+        variant.program.swap(*pending.program);
+        variant.uniforms.locate(variant.id( ), variant.key);
+        swapped.push_back(variant.key);
+        n++;
+        printf("Shader program %u (%s) reloaded from %s and %s in %.2f ms.\n", variant.id( ),
+               variant.key.describe( ).c_str( ),
+               _vertexFile[instanced].c_str( ), _fragmentFile[instanced].c_str( ), 1000.0 * (seconds( ) - pending.start));
+      }else{
+        fprintf(stderr, "Shader program %u (%s) failed to rebuild from %s and %s; keeping it.\n", variant.id( ),
+                variant.key.describe( ).c_str( ),
+                _vertexFile[instanced].c_str( ), _fragmentFile[instanced].c_str( ));
+      }
+      // After a swap this deletes the replaced program.
+      release(pending);
+      _pending.erase(_pending.begin( ) + p);
+    }
+    return n;
+  }
+
+  // The variant for key if it has been built, NULL otherwise
+  ShaderVariant<Uniforms>* find(const ShaderKey& key) const{
+    return _variants[key.index( )];
+  }
+
+  // The variant for key, built now if this is the first request.
+  // built, when given, is set to whether it was.
+  ShaderVariant<Uniforms>& get(const ShaderKey& key, bool* built = NULL){
+    ShaderVariant<Uniforms>*& variant = _variants[key.index( )];
+    if(built){
+      *built = variant == NULL;
+    }
+    if(!variant){
+      variant = new ShaderVariant<Uniforms>( );
+      variant->key = key;
+      build(*variant);
+      variant->uniforms.locate(variant->id( ), key);
+      _count++;
+    }
+    return *variant;
+  }
+
+  // How many variants have been built
+  size_t size( ) const{
+    return _count;
+  }
+
+  void clear( ){
+    while(!_pending.empty( )){
+      release(_pending.back( ));
+      _pending.pop_back( );
+    }
+    for(size_t i = 0; i < _variants.size( ); i++){
+      delete _variants[i];
+      _variants[i] = NULL;
+    }
+    _count = 0;
+  }
+
+private:
+  ProgramCache* _cache;
+  std::string _vertexFile[2];
+  std::string _fragmentFile[2];
+  std::vector<ShaderVariant<Uniforms>*> _variants;
+  size_t _count;
+
+  // A rebuild started by reload( ) that update( ) has not collected
+  struct Pending{
+    size_t index;
+    double start;
+    uint64_t key;
+    GLSLProgram* program;
+    VertexShader* vertexShader;
+    FragmentShader* fragmentShader;
+  };
+  std::vector<Pending> _pending;
+
+  static void release(Pending& pending){
+    delete pending.program;
+    delete pending.vertexShader;
+    delete pending.fragmentShader;
+  }
+
+  void cancel(size_t index){
+    for(size_t p = 0; p < _pending.size( ); p++){
+      if(_pending[p].index == index){
+        release(_pending[p]);
+        _pending.erase(_pending.begin( ) + p);
+        return;
+      }
+    }
+  }
+
+  static std::string readSource(const std::string& filename){
+    char* text = file2strings(filename.c_str( ));
+    std::string source = text ? text : "";
+    free(text);
+    return source;
+  }
+
+  struct Attribute{
+    GLuint location;
+    const char* name;
+  };
+
+  static const Attribute* attributes(size_t& count){
+    static const Attribute table[] = {
+      {ATTRIB_POSITION, "vertexPosition"},
+      {ATTRIB_NORMAL, "vertexNormal"},
+      {ATTRIB_TEXCOORD, "vertexTexCoord"},
+      {ATTRIB_INSTANCE_POSITION, "instancePosition"},
+      {ATTRIB_INSTANCE_SCALE, "instanceScale"},
+      {ATTRIB_INSTANCE_PARAMS, "instanceParams"},
+      {ATTRIB_INSTANCE_TEXRECT, "instanceTextureRect"}
+    };
+    count = sizeof(table) / sizeof(table[0]);
+    return table;
+  }
+
+  static void bindAttributes(GLSLProgram& program){
+    size_t count;
+    const Attribute* table = attributes(count);
+    for(size_t i = 0; i < count; i++){
+      program.bindAttribLocation(table[i].location, table[i].name);
+    }
+  }
+
+  // The cache key covers the sources after the defines went in and
+  // the attribute bindings.
+  uint64_t cacheKey(const std::string& vertexSource, const std::string& fragmentSource) const{
+    uint64_t key = _cache->begin( );
+    key = ProgramCache::add(key, vertexSource);
+    key = ProgramCache::add(key, fragmentSource);
+    size_t count;
+    const Attribute* table = attributes(count);
+    for(size_t i = 0; i < count; i++){
+      key = ProgramCache::add(key, table[i].name);
+      key = ProgramCache::add(key, std::to_string(table[i].location));
+    }
+    return key;
+  }
+
+  bool build(ShaderVariant<Uniforms>& variant){
+    double start = seconds( );
+    GLSLProgram& program = variant.program;
+    const std::string& vertexFile = _vertexFile[variant.key.instanced];
+    const std::string& fragmentFile = _fragmentFile[variant.key.instanced];
+    std::string defines = variant.key.defines( );
+    std::string vertexSource = injectDefines(readSource(vertexFile), defines);
+    std::string fragmentSource = injectDefines(readSource(fragmentFile), defines);
+
+    uint64_t key = 0;
+    bool cached = false;
+    if(_cache){
+      key = cacheKey(vertexSource, fragmentSource);
+      cached = _cache->load(program.id( ), key);
+    }
+    bool rv = cached;
+    if(!cached){
+      VertexShader vertexShader(vertexFile.c_str( ), vertexSource);
+      FragmentShader fragmentShader(fragmentFile.c_str( ), fragmentSource);
+      program.attach(vertexShader);
+      program.attach(fragmentShader);
+      bindAttributes(program);
+      if(_cache){
+        ProgramCache::prepare(program.id( ));
+      }
+      rv = program.link( );
+      if(rv && _cache){
+        _cache->store(program.id( ), key);
+      }
+    }
+    printf("Shader program %u (%s) %s %s and %s in %.2f ms.\n", program.id( ),
+           variant.key.describe( ).c_str( ),
+           cached ? "loaded from the cache for" : "built from",
+           vertexFile.c_str( ), fragmentFile.c_str( ), 1000.0 * (seconds( ) - start));
+    return rv;
+  }
+
+  ShaderVariants(const ShaderVariants&);
+  ShaderVariants& operator=(const ShaderVariants&);
+};
+
+#endif
@@ -9,9 +9,11 @@
 
 #include "Material.h"
 #include "Texture.h"
+#include "Mesh.h"
 #include <vector>
 #include <algorithm>
 #include <math.h>
+#include <cstring>
 
 
 class Square{
@@ -22,14 +24,20 @@ public:
     glm::vec3 forward;
     glm::vec3 scale;  //scale 1 = unit square
     Material *material;
+    // index of material in the application's MaterialLibrary
+    int materialID;
+    // index of image in the application's texture list
+    int textureID;
     Texture *texture;
     bool visible;
     float speedFactor;
     glm::vec3 velocity;
 
     // initialized with face facing +z direction, top edge normal pointing to at +y direction
-    Square(glm::vec3 pos, float s, Material* m): position(pos), scale(glm::vec3(s)){
+    Square(glm::vec3 pos, float s, Material* m): position(pos), scale(glm::vec3(s)), ownsMaterial(false){
       material = m;
+      materialID = 0;
+      textureID = 0;
       visible = true;
       up = glm::vec3(0.0, 1.0, 0.0);
       forward = glm::vec3(0.0, 0.0, 1.0);
@@ -38,8 +46,10 @@ public:
       init();
     }
 
-    Square(glm::vec3 pos, glm::vec3 s, Material* m): position(pos), scale(s){
+    Square(glm::vec3 pos, glm::vec3 s, Material* m): position(pos), scale(s), ownsMaterial(false){
       material = m;
+      materialID = 0;
+      textureID = 0;
       visible = true;
       up = glm::vec3(0.0, 1.0, 0.0);
       forward = glm::vec3(0.0, 0.0, 1.0);
@@ -48,8 +58,10 @@ public:
       init();
     }
 
-    Square():position(glm::vec3(0, 0, 0)), scale(1.0), speedFactor(0.0) {
+    Square():position(glm::vec3(0, 0, 0)), scale(1.0), speedFactor(0.0), ownsMaterial(true) {
       material = new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), glm::vec4(0.5, 0.5, 0.5, 1.0), glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0);
+      materialID = 0;
+      textureID = 0;
       visible = true;
       up = glm::vec3(0.0, 0.0, 1.0);
       forward = glm::vec3(0.0, 1.0, 0.0);
@@ -58,8 +70,12 @@ public:
       init();
     }
 
+    // Materials passed in are shared between squares and owned by the
+    // caller; only the default constructor's own material is deleted.
     ~Square() {
+      if(ownsMaterial){
         delete material;
+      }
     }
 
     bool isColliding(Square& s) {
@@ -141,24 +157,17 @@ public:
     }
 
     void draw() {
-      update();
-      //glBindVertexArray(vao);
-      //glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-      //printf("xyz: %.2f, %.2f, %.2f\n", position.x, position.y, position.z);
-      glBegin(GL_TRIANGLE_STRIP);
-        glTexCoord2f(vertexData[6], vertexData[7]);
-        glVertex3f(vertexData[0], vertexData[1], vertexData[2]);
-        glTexCoord2f(vertexData[14], vertexData[15]);
-        glVertex3f(vertexData[8], vertexData[9], vertexData[10]);
-        glTexCoord2f(vertexData[30], vertexData[31]);
-        glVertex3f(vertexData[24], vertexData[25], vertexData[26]);
-        glTexCoord2f(vertexData[14], vertexData[15]);
-        glVertex3f(vertexData[8], vertexData[9], vertexData[10]);
-        glTexCoord2f(vertexData[22], vertexData[23]);
-        glVertex3f(vertexData[16], vertexData[17], vertexData[18]);
-        glTexCoord2f(vertexData[30], vertexData[31]);
-        glVertex3f(vertexData[24], vertexData[25], vertexData[26]);
-      glEnd();
+      quad().draw();
+    }
+
+    // Every square shares one quad in a vertex buffer; it is uploaded
+    // the first time a square is created and lives as long as the context.
+    static Mesh& quad() {
+      static Mesh* _quad = nullptr;
+      if(!_quad) {
+        _quad = new Mesh();
+      }
+      return *_quad;
     }
 
     // in local coordinates
@@ -181,65 +190,33 @@ public:
 
 
 private:
-
-    unsigned int vao;
-    unsigned int vbo;
-    unsigned int ebo;
+    bool ownsMaterial;
 
     void init() {
-      /*
-      glGenVertexArrays(1, &vao);
-      glGenBuffers(1, &vbo);
-      glBindVertexArray(vao);
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indexData), indexData, GL_STATIC_DRAW);
-
-      // vertex position
-      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-      glEnableVertexAttribArray(0);
-      // vertex color
-      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3* sizeof(float)));
-      glEnableVertexAttribArray(1);
-      // texture coord attribute
-      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-      glEnableVertexAttribArray(2);
-      */
+      if(quad().vao() == 0) {
+        Vertex vertices[4];
+        for(int i = 0; i < 4; i++) {
+          memcpy(vertices[i].position, &vertexData[i*8], 3 * sizeof(float));
+          memcpy(vertices[i].normal, &vertexData[i*8 + 3], 3 * sizeof(float));
+          memcpy(vertices[i].texCoord, &vertexData[i*8 + 6], 2 * sizeof(float));
+        }
+        quad().upload(vertices, 4, indexData, 6);
+      }
     }
-/*
-    static float vertexData[] = {
-      // positions          // texture coords
-       0.5f,  0.5f, 0.0f,   1.0f, 1.0f,   // top right
-       0.5f, -0.5f, 0.0f,   1.0f, 0.0f,   // bottom right
-      -0.5f, -0.5f, 0.0f,   0.0f, 0.0f,   // bottom left
-      -0.5f,  0.5f, 0.0f,   0.0f, 1.0f    // top left 
-    };
-*/
-/*
-    const static float vertexData[] = {
-    // positions          // colors           // texture coords
-       0.5f,  0.5f, 0.0f,   1.0f, 0.0f, 0.0f,   1.0f, 1.0f,   // top right
-       0.5f, -0.5f, 0.0f,   0.0f, 1.0f, 0.0f,   1.0f, 0.0f,   // bottom right
-      -0.5f, -0.5f, 0.0f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,   // bottom left
-      -0.5f,  0.5f, 0.0f,   1.0f, 1.0f, 0.0f,   0.0f, 1.0f    // top left 
-    };
 
-    const static unsigned int indexData[] = {
-        0, 1, 3, // first triangle
-        1, 2, 3  // second triangle
-    };
-*/
     float vertexData[32] = {
-    // positions            // colors           // texture coords
-       0.5f,  0.5f, 0.0f,   1.0f, 0.0f, 0.0f,   1.0f, 1.0f,   // top right
-       0.5f, -0.5f, 0.0f,   0.0f, 1.0f, 0.0f,   1.0f, 0.0f,   // bottom right
+    // positions            // normals          // texture coords
+       0.5f,  0.5f, 0.0f,   0.0f, 0.0f, 1.0f,   1.0f, 1.0f,   // top right
+       0.5f, -0.5f, 0.0f,   0.0f, 0.0f, 1.0f,   1.0f, 0.0f,   // bottom right
       -0.5f, -0.5f, 0.0f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,   // bottom left
-      -0.5f,  0.5f, 0.0f,   1.0f, 1.0f, 0.0f,   0.0f, 1.0f    // top left 
+      -0.5f,  0.5f, 0.0f,   0.0f, 0.0f, 1.0f,   0.0f, 1.0f    // top left 
     };
 
-    unsigned int indexData[6] = {
+    GLuint indexData[6] = {
         0, 1, 3, // first triangle
         1, 2, 3  // second triangle
     };
+
+    Square(const Square&);
+    Square& operator=(const Square&);
 };
\ No newline at end of file
@@ -0,0 +1,170 @@
+//
+// A buffer for data that is rewritten every frame.
+//
+// The buffer is split into three regions used round robin. With
+// ARB_buffer_storage the whole buffer is mapped once, persistently
+// and coherently, so the CPU writes straight into memory the GPU
+// reads; a fence placed after the draws that read a region is
+// waited on before that region is written again, three frames
+// later. Without it the data is staged in client memory and
+// handed over with glBufferSubData into freshly orphaned storage.
+//
+//
+
+#include <cstdio>
+#include <cstddef>
+#include <vector>
+#include <GL/glew.h>
+
+#include "GLStateCache.h"
+
+#ifndef _STREAM_BUFFER_H_
+#define _STREAM_BUFFER_H_
+
+class StreamBuffer{
+public:
+  static const int REGIONS = 3;
+
+  StreamBuffer(GLenum target = GL_ARRAY_BUFFER, size_t alignment = 16) :
+    _target(target), _alignment(alignment), _buffer(0), _regionSize(0),
+    _region(0), _offset(0), _mapped(NULL), _persistent(supportsPersistent( )){
+    for(int i = 0; i < REGIONS; i++){
+      _fences[i] = 0;
+    }
+  }
+
+  ~StreamBuffer( ){
+    release( );
+  }
+
+  static bool supportsPersistent( ){
+    return GLEW_ARB_buffer_storage && GLEW_ARB_sync && GLEW_ARB_map_buffer_range;
+  }
+
+  // Returns where this frame's bytes are to be written. The pointer is
+  // valid until unmap( ).
+  void* map(size_t bytes){
+    if(bytes > _regionSize){
+      allocate(bytes);
+    }
+    if(_persistent){
+      wait(_region);
+      _offset = _region * _regionSize;
+      return _mapped + _offset;
+    }
+    _offset = 0;
+    return _staging.empty( ) ? NULL : &_staging[0];
+  }
+
+  // Makes the first bytes written since map( ) visible to GL. The data
+  // starts at offset( ) in buffer( ).
+  void unmap(size_t bytes){
+    if(!_persistent && bytes > 0){
+      GLStateCache::current( ).bindBuffer(_target, _buffer);
+      // Orphan the storage the GPU may still be reading from
+      glBufferData(_target, _regionSize, NULL, GL_STREAM_DRAW);
+      glBufferSubData(_target, 0, bytes, &_staging[0]);
+      GLStateCache::current( ).bindBuffer(_target, 0);
+    }
+  }
+
+  // Call once the draws reading this frame's region have been issued.
+  void fence( ){
+    if(_persistent){
+      _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      _region = (_region + 1) % REGIONS;
+    }
+  }
+
+  GLuint buffer( ) const{
+    return _buffer;
+  }
+
+  size_t offset( ) const{
+    return _offset;
+  }
+
+  bool persistent( ) const{
+    return _persistent;
+  }
+
+private:
+  GLenum _target;
+  size_t _alignment;
+  GLuint _buffer;
+  size_t _regionSize;
+  int _region;
+  size_t _offset;
+  char* _mapped;
+  bool _persistent;
+  GLsync _fences[REGIONS];
+  std::vector<char> _staging;
+
+  void wait(int region){
+    if(!_fences[region]){
+      return;
+    }
+    GLenum rv = glClientWaitSync(_fences[region], 0, 0);
+    while(rv == GL_TIMEOUT_EXPIRED){
+      // The GPU is more than two frames behind; flush and block.
+      rv = glClientWaitSync(_fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+    if(rv == GL_WAIT_FAILED){
+      fprintf(stderr, "StreamBuffer: glClientWaitSync failed\n");
+    }
+    glDeleteSync(_fences[region]);
+    _fences[region] = 0;
+  }
+
+  void release( ){
+    for(int i = 0; i < REGIONS; i++){
+      wait(i);
+    }
+    if(_buffer){
+      if(_mapped){
+        GLStateCache::current( ).bindBuffer(_target, _buffer);
+        glUnmapBuffer(_target);
+        _mapped = NULL;
+      }
+      // Deleting a bound buffer unbinds it behind the cache's back and
+      // the name may be handed out again by the next glGenBuffers.
+      GLStateCache::current( ).bindBuffer(_target, 0);
+      glDeleteBuffers(1, &_buffer);
+      _buffer = 0;
+    }
+  }
+
+  void allocate(size_t bytes){
+    release( );
+    // Grow geometrically so a slowly growing scene reallocates rarely;
+    // regions are aligned for use as uniform buffer ranges.
+    size_t size = bytes * 2 > _regionSize * 2 ? bytes * 2 : _regionSize * 2;
+    _regionSize = (size + _alignment - 1) / _alignment * _alignment;
+    _region = 0;
+    glGenBuffers(1, &_buffer);
+    GLStateCache::current( ).bindBuffer(_target, _buffer);
+    if(_persistent){
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(_target, _regionSize * REGIONS, NULL, flags);
+      _mapped = (char*)glMapBufferRange(_target, 0, _regionSize * REGIONS, flags);
+      if(!_mapped){
+        fprintf(stderr, "StreamBuffer: persistent mapping failed, falling back to glBufferSubData\n");
+        GLStateCache::current( ).bindBuffer(_target, 0);
+        glDeleteBuffers(1, &_buffer);
+        _persistent = false;
+        glGenBuffers(1, &_buffer);
+        GLStateCache::current( ).bindBuffer(_target, _buffer);
+      }
+    }
+    if(!_persistent){
+      glBufferData(_target, _regionSize, NULL, GL_STREAM_DRAW);
+      _staging.resize(_regionSize);
+    }
+    GLStateCache::current( ).bindBuffer(_target, 0);
+  }
+
+  StreamBuffer(const StreamBuffer&);
+  StreamBuffer& operator=(const StreamBuffer&);
+};
+
+#endif
@@ -0,0 +1,136 @@
+//
+// Many teapots, each drawn at a level of detail chosen from its size
+// on screen.
+//
+// Each teapot is a position, a uniform scale and a material index.
+// update( ) culls the teapots' bounding boxes against the view
+// frustum through a QuadTree, built once since teapots do not move,
+// and picks every survivor's level of detail from its projected
+// size (see UtahTeapot::chooseLOD). The field draws nothing itself:
+// the application keys the visible teapots into its own DrawList,
+// one mesh per level, so they are sorted and batched together with
+// everything else it draws.
+//
+//
+
+#include <vector>
+#include <stdint.h>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "Camera.h"
+#include "Frustum.h"
+#include "QuadTree.h"
+#include "UtahTeapot.h"
+
+#ifndef _TEAPOT_FIELD_H_
+#define _TEAPOT_FIELD_H_
+
+struct TeapotInstance{
+  glm::vec3 position;
+  float scale;
+  // index of material in the application's MaterialLibrary
+  int materialID;
+  // Current level of detail, -1 until the first update( )
+  int lod;
+  // Distance along the view direction at the last update( )
+  float depth;
+};
+
+class TeapotField{
+public:
+  TeapotField( ) : _treeBuilt(false){
+    clearBuckets( );
+  }
+
+  void clear( ){
+    _teapots.clear( );
+    _bounds.clear( );
+    _treeBuilt = false;
+    _visible.clear( );
+    clearBuckets( );
+  }
+
+  void add(const glm::vec3& position, float scale, int materialID){
+    TeapotInstance t;
+    t.position = position;
+    t.scale = scale;
+    t.materialID = materialID;
+    t.lod = -1;
+    t.depth = 0.0f;
+    _teapots.push_back(t);
+    // The bounding sphere's box; teapots do not move or rotate.
+    _bounds.add(position, glm::vec3(UtahTeapot::boundingRadius( ) * scale));
+    _treeBuilt = false;
+  }
+
+  size_t size( ) const{
+    return _teapots.size( );
+  }
+
+  TeapotInstance& operator [](size_t i){
+    return _teapots[i];
+  }
+
+  // Culls the teapots outside frustum and selects each remaining
+  // teapot's level of detail for this frame.
+  void update(Camera& camera, const Frustum& frustum, const glm::mat4& viewMatrix, int viewportHeight){
+    if(!_treeBuilt){
+      _tree.build(_bounds);
+      _treeBuilt = true;
+    }
+    _visible.clear( );
+    _tree.cull(frustum, _visible);
+    clearBuckets( );
+    for(size_t v = 0; v < _visible.size( ); v++){
+      TeapotInstance& t = _teapots[_visible[v]];
+      t.depth = -(viewMatrix * glm::vec4(t.position, 1.0)).z;
+      float pixels = camera.projectedRadius(UtahTeapot::boundingRadius( ) * t.scale, t.depth, viewportHeight);
+      t.lod = UtahTeapot::chooseLOD(pixels, t.lod);
+      _count[t.lod]++;
+    }
+  }
+
+  // Teapots at level after the last update( )
+  size_t bucketSize(int level) const{
+    return _count[level];
+  }
+
+  size_t triangles( ) const{
+    size_t n = 0;
+    for(int level = 0; level < UtahTeapot::LOD_COUNT; level++){
+      n += _count[level] * (_glutTeapotIndexCount(UtahTeapot::lodGrid(level)) / 3);
+    }
+    return n;
+  }
+
+  // The teapots that survived culling, in no particular order
+  size_t visibleCount( ) const{
+    return _visible.size( );
+  }
+
+  // The index of the i-th visible teapot among all the teapots
+  uint32_t visible(size_t i) const{
+    return _visible[i];
+  }
+
+private:
+  std::vector<TeapotInstance> _teapots;
+  AABBBatch _bounds;
+  QuadTree _tree;
+  bool _treeBuilt;
+  std::vector<uint32_t> _visible;
+  size_t _count[UtahTeapot::LOD_COUNT];
+
+  void clearBuckets( ){
+    for(int level = 0; level < UtahTeapot::LOD_COUNT; level++){
+      _count[level] = 0;
+    }
+  }
+
+  TeapotField(const TeapotField&);
+  TeapotField& operator=(const TeapotField&);
+};
+
+#endif
@@ -1,51 +1,137 @@
+#include <cstdio>
 #include <iostream>
 #include <glm/vec3.hpp>
 
 #ifndef _TEXTURE_H_
 #define _TEXTURE_H_
 
+// Images are decoded on worker threads, and stb_image's failure
+// reason is a global every decoder writes. Without the strings nothing
+// writes it; the GIF header reader still does, and only PNGs and JPEGs
+// are loaded.
+#define STBI_NO_FAILURE_STRINGS
+#define STBI_NO_GIF
 #define STB_IMAGE_IMPLEMENTATION
+// Without the strings stb_image's error returns become bare 0s and
+// its error setter goes unused
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-value"
+#pragma GCC diagnostic ignored "-Wunused-function"
 #include "stb_image.h"
+#pragma GCC diagnostic pop
+
+#include "GLStateCache.h"
+
+// How a Texture is sampled. Mipmaps are built only for a minifying
+// filter that reads them.
+struct TextureOptions{
+  GLint minFilter;
+  GLint magFilter;
+  GLint wrap;
+
+  TextureOptions(GLint minFilter = GL_NEAREST, GLint magFilter = GL_NEAREST, GLint wrap = GL_CLAMP_TO_EDGE) :
+    minFilter(minFilter), magFilter(magFilter), wrap(wrap){ }
+
+  bool mipmapped( ) const{
+    return minFilter != GL_NEAREST && minFilter != GL_LINEAR;
+  }
+};
 
 class Texture{
 public:
   GLuint texID;
 
-  Texture(const char *filename) {
-    int texture_width, texture_height, nrChannels;
-    glEnable(GL_TEXTURE_2D);
-    glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_2D, texID);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  Texture(const char *filename, const TextureOptions& options = TextureOptions( )) : _options(options) {
+    int texture_width, texture_height;
+    const char* reason;
+    create( );
 
-    unsigned char* data = stbi_load(filename, &texture_width, &texture_height, &nrChannels, 0);
+    unsigned char* data = decode(filename, texture_width, texture_height, reason);
     if (data) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        upload(texture_width, texture_height, data);
     } else {
-        std::cout << "Failed to load texture" << std::endl;
+        std::cout << "Failed to load texture " << filename << ": " << reason << std::endl;
     }
     stbi_image_free(data);
     //unbind();
   }
 
+  // A single white texel, which leaves the material's color as it is,
+  // until upload( ) replaces it with the image
+  explicit Texture(const TextureOptions& options) : _options(options) {
+    static const unsigned char white[4] = {255, 255, 255, 255};
+    create( );
+    upload(1, 1, white);
+  }
+
+  // Decodes filename to RGBA, bottom row first, or returns NULL and
+  // says why in reason. Free the pixels with stbi_image_free. Safe to
+  // call from several threads at once.
+  static unsigned char* decode(const char* filename, int& width, int& height, const char*& reason){
+    // GL's first row is the bottom of the image. stb_image keeps the
+    // flag in a global the decoders read, so it is set exactly once,
+    // and every decode waits for that.
+    static const int flipped = (stbi_set_flip_vertically_on_load(1), 1);
+    (void)flipped;
+    FILE* file = fopen(filename, "rb");
+    if(!file){
+      reason = "can't open the file";
+      return NULL;
+    }
+    // Always expanded to RGBA; core profiles have no luminance formats.
+    int channels;
+    unsigned char* pixels = stbi_load_from_file(file, &width, &height, &channels, 4);
+    fclose(file);
+    if(!pixels){
+      reason = "not an image stb_image decodes";
+    }
+    return pixels;
+  }
+
+  // Replaces the texture's image with width by height RGBA pixels,
+  // bottom row first
+  void upload(int width, int height, const unsigned char* pixels) {
+    GLStateCache& state = GLStateCache::current( );
+    state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texID);
+    // A bind the cache skipped leaves the active unit wherever the last
+    // draw put it
+    state.activeTexture(GL_TEXTURE0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    if(_options.mipmapped( )){
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
+  }
+
   ~Texture() {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLStateCache::current( ).bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
     glDeleteTextures(1, &texID);
   }
 
   void bind() {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texID);
+    GLStateCache::current( ).bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texID);
   }
 
   void unbind() {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLStateCache::current( ).bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+  }
+
+private:
+  TextureOptions _options;
+
+  void create( ){
+    glGenTextures(1, &texID);
+    GLStateCache& state = GLStateCache::current( );
+    state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texID);
+    state.activeTexture(GL_TEXTURE0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, _options.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, _options.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, _options.minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, _options.magFilter);
   }
 
+  Texture(const Texture&);
+  Texture& operator=(const Texture&);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,282 @@
+//
+// Many images behind one texture binding.
+//
+// When every image has the same size they become the layers of a
+// GL_TEXTURE_2D_ARRAY. When the sizes differ they are shelf packed
+// into a single atlas, stored as a one layer array so the shader
+// samples both cases the same way. Either way each image is a layer
+// plus a rectangle of texture coordinates, which instanced draws
+// carry per instance, so switching images costs no state change.
+//
+// The images are decoded by an AsyncTextureLoader. Until an image
+// arrives its layer is a plain white one, which leaves the material's
+// color as it is. The first image sets the size of the layers, and
+// each image of that size is uploaded into its own layer as it comes
+// in. Once all have arrived the layers are mipmapped, or, if the sizes
+// turned out to differ, every image is packed into the atlas.
+//
+//
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <GL/glew.h>
+#include <glm/vec4.hpp>
+
+#include <memory>
+
+#include "GLStateCache.h"
+#include "AsyncTextureLoader.h"
+
+#ifndef _TEXTURE_ARRAY_H_
+#define _TEXTURE_ARRAY_H_
+
+class TextureArray{
+public:
+  TextureArray( ) : _id(0), _width(0), _height(0), _layers(0), _atlas(false), _received(0), _sameSize(true){ }
+
+  ~TextureArray( ){
+    if(_id){
+      glDeleteTextures(1, &_id);
+    }
+  }
+
+  static bool supported( ){
+    return GLEW_VERSION_3_0 || GLEW_EXT_texture_array;
+  }
+
+  // Queues every image on loader; the index of a file in filenames is
+  // its image index from then on. Images still on their way from an
+  // earlier load( ) are ignored.
+  bool load(const std::vector<std::string>& filenames, AsyncTextureLoader& loader){
+    if(filenames.empty( )){
+      return false;
+    }
+    _images.assign(filenames.size( ), Image( ));
+    _received = 0;
+    _sameSize = true;
+    _atlas = false;
+    _layer.assign(filenames.size( ), 0.0);
+    _rect.assign(filenames.size( ), glm::vec4(0.0, 0.0, 1.0, 1.0));
+    static const unsigned char white[4] = {255, 255, 255, 255};
+    if(!_id){
+      glGenTextures(1, &_id);
+    }
+    GLStateCache& state = bindForUpload( );
+    _width = 1;
+    _height = 1;
+    _layers = 1;
+    glTexImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY_EXT, 0);
+    _receiver = std::shared_ptr<Receiver>(new Receiver(this));
+    for(size_t i = 0; i < filenames.size( ); i++){
+      loader.load(_receiver, int(i), filenames[i]);
+    }
+    return true;
+  }
+
+  // Whether every image has arrived
+  bool loaded( ) const{
+    return _received == _images.size( );
+  }
+
+  void bind(GLenum unit = GL_TEXTURE0){
+    GLStateCache::current( ).bindTexture(unit, GL_TEXTURE_2D_ARRAY_EXT, _id);
+  }
+
+  void unbind(GLenum unit = GL_TEXTURE0){
+    GLStateCache::current( ).bindTexture(unit, GL_TEXTURE_2D_ARRAY_EXT, 0);
+  }
+
+  GLuint id( ) const{
+    return _id;
+  }
+
+  int size( ) const{
+    return int(_layer.size( ));
+  }
+
+  bool isAtlas( ) const{
+    return _atlas;
+  }
+
+  float layer(int image) const{
+    return _layer[image];
+  }
+
+  // (u offset, v offset, u extent, v extent) of image within its layer
+  const glm::vec4& rect(int image) const{
+    return _rect[image];
+  }
+
+private:
+  struct Image{
+    Image( ) : width(0), height(0), x(0), y(0){ }
+    // Kept until every image has arrived, in case they go in an atlas
+    std::vector<unsigned char> pixels;
+    int width;
+    int height;
+    // position in the atlas
+    int x;
+    int y;
+  };
+
+  GLuint _id;
+  int _width;
+  int _height;
+  int _layers;
+  bool _atlas;
+  std::vector<float> _layer;
+  std::vector<glm::vec4> _rect;
+
+  // Passes the loader's images on for as long as the array holds it
+  class Receiver : public AsyncTextureLoader::Receiver{
+  public:
+    explicit Receiver(TextureArray* array) : _array(array){ }
+
+    void receive(int image, int width, int height, const unsigned char* pixels){
+      _array->receive(image, width, height, pixels);
+    }
+
+  private:
+    TextureArray* _array;
+  };
+
+  std::shared_ptr<Receiver> _receiver;
+  std::vector<Image> _images;
+  size_t _received;
+  // Whether every image loaded so far is _width by _height
+  bool _sameSize;
+
+  GLStateCache& bindForUpload( ){
+    GLStateCache& state = GLStateCache::current( );
+    state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY_EXT, _id);
+    // The bind may have been skipped with another unit active
+    state.activeTexture(GL_TEXTURE0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    return state;
+  }
+
+  // An image that failed to load stays white
+  void receive(int index, int width, int height, const unsigned char* pixels){
+    static const unsigned char white[4] = {255, 255, 255, 255};
+    Image& image = _images[index];
+    if(pixels){
+      image.width = width;
+      image.height = height;
+      image.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+    }else{
+      image.width = 1;
+      image.height = 1;
+      image.pixels.assign(white, white + 4);
+    }
+    _received++;
+    GLStateCache& state = bindForUpload( );
+    // Until the first image arrives the array is one white texel
+    if(pixels && _layers == 1){
+      allocateLayers(width, height);
+    }
+    if(pixels && width == _width && height == _height){
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, 0, 0, index, _width, _height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+      _layer[index] = float(index);
+    }else if(pixels){
+      _sameSize = false;
+    }
+    if(loaded( )){
+      // Without room for the atlas the layers stay as they are, and the
+      // images of another size keep pointing at the white layer.
+      if((_sameSize || !loadAtlas(_images)) && _layers > 1){
+        glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY_EXT);
+      }
+      // Only the count is needed from here on
+      std::vector<Image>(_images.size( )).swap(_images);
+    }
+    state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY_EXT, 0);
+  }
+
+  // A layer per image plus a last, white one, which every image points
+  // at until its own arrives
+  void allocateLayers(int width, int height){
+    _width = width;
+    _height = height;
+    _layers = int(_images.size( )) + 1;
+    glTexImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, GL_RGBA8, _width, _height, _layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    std::vector<unsigned char> white(size_t(_width) * _height * 4, 255);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, 0, 0, _layers - 1, _width, _height, 1, GL_RGBA, GL_UNSIGNED_BYTE, &white[0]);
+    _layer.assign(_images.size( ), float(_layers - 1));
+  }
+
+  static bool tallerFirst(const Image* a, const Image* b){
+    return a->height > b->height;
+  }
+
+  // Leaves the array as it was when the atlas would not fit.
+  bool loadAtlas(std::vector<Image>& images){
+    // Shelf packing: tallest images first, left to right along a shelf
+    // as tall as its first image, a new shelf when the row is full.
+    std::vector<Image*> order;
+    size_t area = 0;
+    int widest = 0;
+    for(size_t i = 0; i < images.size( ); i++){
+      order.push_back(&images[i]);
+      area += size_t(images[i].width) * images[i].height;
+      widest = std::max(widest, images[i].width);
+    }
+    std::sort(order.begin( ), order.end( ), tallerFirst);
+    int width = std::max(widest, int(ceil(sqrt(double(area)))));
+    int x = 0, y = 0, shelfHeight = 0;
+    for(size_t i = 0; i < order.size( ); i++){
+      if(x + order[i]->width > width){
+        x = 0;
+        y += shelfHeight;
+        shelfHeight = 0;
+      }
+      order[i]->x = x;
+      order[i]->y = y;
+      x += order[i]->width;
+      shelfHeight = std::max(shelfHeight, order[i]->height);
+    }
+    int height = y + shelfHeight;
+
+    GLint maxSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if(width > maxSize || height > maxSize){
+      fprintf(stderr, "TextureArray: %dx%d atlas exceeds GL_MAX_TEXTURE_SIZE %d\n", width, height, maxSize);
+      return false;
+    }
+    _atlas = true;
+    _width = width;
+    _height = height;
+    _layers = 1;
+
+    std::vector<unsigned char> atlas(size_t(_width) * _height * 4, 0);
+    _layer.clear( );
+    _rect.clear( );
+    for(size_t i = 0; i < images.size( ); i++){
+      Image& image = images[i];
+      for(int row = 0; row < image.height; row++){
+        memcpy(&atlas[(size_t(image.y + row) * _width + image.x) * 4], &image.pixels[size_t(row) * image.width * 4], image.width * 4);
+      }
+      _layer.push_back(0.0);
+      // Inset by half a texel so linear filtering stays inside the image
+      _rect.push_back(glm::vec4((image.x + 0.5) / _width, (image.y + 0.5) / _height,
+                                (image.width - 1.0) / _width, (image.height - 1.0) / _height));
+    }
+    glTexImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, GL_RGBA8, _width, _height, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &atlas[0]);
+    // Mipmaps would blend neighbouring images together
+    glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    return true;
+  }
+
+  TextureArray(const TextureArray&);
+  TextureArray& operator=(const TextureArray&);
+};
+
+#endif
@@ -0,0 +1,146 @@
+//
+// Shares Textures by file and sampling options.
+//
+// get( ) hands out a reference counted handle to the texture for a
+// file, decoding and uploading the image only if no handle to the
+// same texture is still held. Files are keyed by their canonical
+// path, so "textures/a.png" and "./textures/../textures/a.png" are
+// one texture, and by their TextureOptions, so the same image
+// sampled two ways is two textures. The cache itself holds no
+// reference: when the last handle is dropped the Texture is deleted
+// and its GL name freed, and the next get( ) loads it again.
+//
+// Given an AsyncTextureLoader, get( ) returns at once with a
+// placeholder texture the loader fills in later, and a future that
+// tells when it has; a hit on a texture still loading shares the
+// same future.
+//
+// Handles must be dropped while the context is current.
+//
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <string>
+#include <map>
+#include <memory>
+#include <future>
+
+#include "Texture.h"
+#include "AsyncTextureLoader.h"
+
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+class TextureCache{
+public:
+  typedef std::shared_ptr<Texture> Handle;
+
+  TextureCache( ) : _hits(0), _misses(0){ }
+
+  Handle get(const std::string& path, const TextureOptions& options = TextureOptions( )){
+    std::string key = makeKey(path, options);
+    Handle texture = find(key);
+    if(texture){
+      return texture;
+    }
+    texture = Handle(new Texture(path.c_str( ), options));
+    std::promise<bool> loaded;
+    loaded.set_value(true);
+    _entries[key] = Entry(texture, loaded.get_future( ).share( ));
+    return texture;
+  }
+
+  Handle get(const std::string& path, AsyncTextureLoader& loader, std::shared_future<bool>* ready = NULL,
+             const TextureOptions& options = TextureOptions( )){
+    std::string key = makeKey(path, options);
+    Handle texture = find(key);
+    if(!texture){
+      texture = Handle(new Texture(options));
+      _entries[key] = Entry(texture, loader.load(texture, path));
+    }
+    if(ready){
+      *ready = _entries[key].ready;
+    }
+    return texture;
+  }
+
+  // Textures with a handle still held
+  size_t live( ){
+    size_t n = 0;
+    for(Entries::iterator i = _entries.begin( ); i != _entries.end( ); ){
+      if(i->second.texture.expired( )){
+        _entries.erase(i++);
+      }else{
+        n++;
+        ++i;
+      }
+    }
+    return n;
+  }
+
+  // Since construction or the last resetCounts( )
+  unsigned int hits( ) const{
+    return _hits;
+  }
+
+  unsigned int misses( ) const{
+    return _misses;
+  }
+
+  void resetCounts( ){
+    _hits = 0;
+    _misses = 0;
+  }
+
+private:
+  struct Entry{
+    std::weak_ptr<Texture> texture;
+    std::shared_future<bool> ready;
+
+    Entry( ){ }
+    Entry(const Handle& texture, const std::shared_future<bool>& ready) : texture(texture), ready(ready){ }
+  };
+
+  typedef std::map<std::string, Entry> Entries;
+  Entries _entries;
+  unsigned int _hits;
+  unsigned int _misses;
+
+  static std::string makeKey(const std::string& path, const TextureOptions& options){
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), "|%x|%x|%x", options.minFilter, options.magFilter, options.wrap);
+    return canonical(path) + suffix;
+  }
+
+  // The live texture for key, counting the hit or miss
+  Handle find(const std::string& key){
+    Entries::iterator i = _entries.find(key);
+    Handle texture;
+    if(i != _entries.end( )){
+      texture = i->second.texture.lock( );
+    }
+    if(texture){
+      _hits++;
+    }else{
+      _misses++;
+    }
+    return texture;
+  }
+
+  // A file that can't be resolved keys by the path as given, and
+  // fails to load as it would have anyway.
+  static std::string canonical(const std::string& path){
+    char resolved[PATH_MAX];
+    if(realpath(path.c_str( ), resolved)){
+      return resolved;
+    }
+    return path;
+  }
+
+  TextureCache(const TextureCache&);
+  TextureCache& operator=(const TextureCache&);
+};
+
+#endif
@@ -0,0 +1,159 @@
+//
+// A hierarchy of transforms that caches each node's world, model view
+// and normal matrices and recomputes only what changed.
+//
+// Nodes are kept in flat arrays, a parent always before its children,
+// so one pass from the front sees every parent's world matrix settled
+// before its children need it. setLocal( ) marks a node dirty when its
+// local matrix actually changes; update( ) then recomputes the world
+// matrix of each dirty node and of everything under it, and the model
+// view and normal matrices of those nodes. A changed view matrix
+// recomputes every model view and normal matrix but no world matrix,
+// so with a still camera a node that does not move costs nothing.
+// Normal matrices are computed by NormalMatrices over each run of
+// consecutive recomputed nodes, so a changed view is a single pass
+// over the whole array and nodes that move together, like siblings
+// added one after another, are one pass too.
+//
+//
+
+#include <vector>
+#include <stdint.h>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "NormalMatrices.h"
+
+#ifndef _TRANSFORM_HIERARCHY_H_
+#define _TRANSFORM_HIERARCHY_H_
+
+class TransformHierarchy{
+public:
+  enum{ NO_PARENT = -1 };
+
+  TransformHierarchy( ) : _viewValid(false){ }
+
+  void clear( ){
+    _parent.clear( );
+    _dirty.clear( );
+    _changed.clear( );
+    _local.clear( );
+    _world.clear( );
+    _modelView.clear( );
+    _normal.clear( );
+    _viewValid = false;
+  }
+
+  // Appends a node; parent must already be in the hierarchy. Returns
+  // the node's index.
+  uint32_t add(const glm::mat4& local, int parent = NO_PARENT){
+    uint32_t node = uint32_t(_parent.size( ));
+    _parent.push_back(parent);
+    _dirty.push_back(1);
+    _changed.push_back(0);
+    _local.push_back(local);
+    _world.push_back(local);
+    _modelView.push_back(local);
+    _normal.push_back(glm::mat4(1.0f));
+    return node;
+  }
+
+  size_t size( ) const{
+    return _parent.size( );
+  }
+
+  void setLocal(uint32_t node, const glm::mat4& local){
+    if(local != _local[node]){
+      _local[node] = local;
+      _dirty[node] = 1;
+    }
+  }
+
+  // The common local transform, a scale then a translation, built
+  // without multiplying matrices.
+  static glm::mat4 translateScale(const glm::vec3& translation, const glm::vec3& scale){
+    glm::mat4 m(1.0f);
+    m[0][0] = scale.x;
+    m[1][1] = scale.y;
+    m[2][2] = scale.z;
+    m[3] = glm::vec4(translation, 1.0f);
+    return m;
+  }
+
+  // Brings every matrix up to date for this view; returns how many
+  // nodes' model view matrices were recomputed.
+  size_t update(const glm::mat4& view){
+    bool viewChanged = !_viewValid || view != _view;
+    _view = view;
+    _viewValid = true;
+    size_t recomputed = 0;
+    // Nodes [first, last) still need their normal matrices
+    size_t first = 0, last = 0;
+    for(size_t i = 0; i < _parent.size( ); i++){
+      int p = _parent[i];
+      bool changed = _dirty[i] || (p != NO_PARENT && _changed[p]);
+      if(changed){
+        _world[i] = p == NO_PARENT ? _local[i] : _world[p] * _local[i];
+      }
+      _dirty[i] = 0;
+      _changed[i] = changed;
+      if(changed || viewChanged){
+        _modelView[i] = view * _world[i];
+        if(i != last){
+          computeNormals(first, last);
+          first = i;
+        }
+        last = i + 1;
+        recomputed++;
+      }
+    }
+    computeNormals(first, last);
+    return recomputed;
+  }
+
+  const glm::mat4& local(uint32_t node) const{
+    return _local[node];
+  }
+
+  const glm::mat4& world(uint32_t node) const{
+    return _world[node];
+  }
+
+  // As of the last update( )
+  const glm::mat4& modelView(uint32_t node) const{
+    return _modelView[node];
+  }
+
+  const glm::mat4& normal(uint32_t node) const{
+    return _normal[node];
+  }
+
+  // How many normal matrices took each path; see NormalMatrices.h
+  NormalMatrices& normalMatrices( ){
+    return _normalMatrices;
+  }
+
+private:
+  std::vector<int> _parent;
+  std::vector<uint8_t> _dirty;
+  // Whether the world matrix changed in the current update( )
+  std::vector<uint8_t> _changed;
+  std::vector<glm::mat4> _local;
+  std::vector<glm::mat4> _world;
+  std::vector<glm::mat4> _modelView;
+  std::vector<glm::mat4> _normal;
+  NormalMatrices _normalMatrices;
+  glm::mat4 _view;
+  bool _viewValid;
+
+  void computeNormals(size_t first, size_t last){
+    if(last > first){
+      _normalMatrices.compute(&_modelView[first], &_normal[first], last - first);
+    }
+  }
+
+  TransformHierarchy(const TransformHierarchy&);
+  TransformHierarchy& operator=(const TransformHierarchy&);
+};
+
+#endif
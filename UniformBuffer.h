@@ -0,0 +1,131 @@
+//
+// Uniform buffer objects for the blocks in blinn_phong_ubo.*.glsl.
+//
+// Values shared by every draw in a frame (view, projection, lights)
+// live in one block written once per frame, and the material palette
+// lives in a second block uploaded once, so a frame costs one buffer
+// update and a range bind instead of a run of glUniform* calls per
+// program. Per-draw values stay in instance attributes.
+//
+// The blocks use the std140 layout; the structs below mirror them
+// with only mat4 and vec4 members so no padding is needed.
+//
+//
+
+#include <cstdio>
+#include <cstddef>
+#include <GL/glew.h>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+
+#include "Material.h"
+#include "StreamBuffer.h"
+#include "GLStateCache.h"
+
+#ifndef _UNIFORM_BUFFER_H_
+#define _UNIFORM_BUFFER_H_
+
+// Binding points of the uniform blocks
+enum UniformBlockBinding{
+  FRAME_BLOCK = 0,
+  MATERIAL_BLOCK = 1
+};
+
+// layout(std140) uniform FrameBlock
+struct FrameUniforms{
+  glm::mat4 viewMatrix;
+  glm::mat4 projectionMatrix;
+  // Eye space
+  glm::vec4 light0_position;
+  glm::vec4 light0_color;
+  glm::vec4 light1_position;
+  glm::vec4 light1_color;
+};
+
+// layout(std140) uniform MaterialBlock; specular.w holds the shininess
+struct MaterialUniforms{
+  glm::vec4 ambient[MaterialLibrary::MAX_MATERIALS];
+  glm::vec4 diffuse[MaterialLibrary::MAX_MATERIALS];
+  glm::vec4 specular[MaterialLibrary::MAX_MATERIALS];
+};
+
+class UniformBuffer{
+public:
+  // A buffer is either streamed, rewritten every frame through a
+  // StreamBuffer ring with map( )/unmap( ), or uploaded once with
+  // upload( ) and left bound.
+  UniformBuffer(GLuint binding) :
+    _binding(binding), _stream(NULL), _buffer(0), _bytes(0){ }
+
+  ~UniformBuffer( ){
+    delete _stream;
+    if(_buffer){
+      GLStateCache::current( ).bindBuffer(GL_UNIFORM_BUFFER, 0);
+      glDeleteBuffers(1, &_buffer);
+    }
+  }
+
+  // Uniform blocks need GLSL 1.40, which comes with OpenGL 3.1.
+  static bool supported( ){
+    return GLEW_VERSION_3_1;
+  }
+
+  // Points the named block of program at binding.
+  static bool bindBlock(GLuint program, const char* name, GLuint binding){
+    GLuint index = glGetUniformBlockIndex(program, name);
+    if(index == GL_INVALID_INDEX){
+      fprintf(stderr, "UniformBuffer: program %u has no uniform block %s\n", program, name);
+      return false;
+    }
+    glUniformBlockBinding(program, index, binding);
+    return true;
+  }
+
+  // Streamed buffers: returns where this frame's block is to be
+  // written; unmap( ) then binds it.
+  void* map(size_t bytes){
+    if(!_stream){
+      // Ranges bound to a binding point must start at a multiple of
+      // this, so every region does.
+      GLint alignment;
+      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+      _stream = new StreamBuffer(GL_UNIFORM_BUFFER, alignment > 0 ? size_t(alignment) : 256);
+    }
+    _bytes = bytes;
+    return _stream->map(bytes);
+  }
+
+  void unmap( ){
+    _stream->unmap(_bytes);
+    GLStateCache::current( ).bindBufferRange(GL_UNIFORM_BUFFER, _binding, _stream->buffer( ), _stream->offset( ), _bytes);
+  }
+
+  // Call once the draws reading this frame's block have been issued.
+  void fence( ){
+    if(_stream){
+      _stream->fence( );
+    }
+  }
+
+  // Static buffers: replaces the contents and binds them.
+  void upload(const void* data, size_t bytes){
+    GLStateCache& state = GLStateCache::current( );
+    if(!_buffer){
+      glGenBuffers(1, &_buffer);
+    }
+    state.bindBuffer(GL_UNIFORM_BUFFER, _buffer);
+    glBufferData(GL_UNIFORM_BUFFER, bytes, data, GL_STATIC_DRAW);
+    state.bindBufferRange(GL_UNIFORM_BUFFER, _binding, _buffer, 0, bytes);
+  }
+
+private:
+  GLuint _binding;
+  StreamBuffer* _stream;
+  GLuint _buffer;
+  size_t _bytes;
+
+  UniformBuffer(const UniformBuffer&);
+  UniformBuffer& operator=(const UniformBuffer&);
+};
+
+#endif
@@ -7,7 +7,14 @@
 //
 
 #include <iostream>
+#include <cmath>
+#include <map>
+#include <vector>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include "Mesh.h"
+#include "Camera.h"
 #include "glut_teapot.h"
 #include "Material.h"
 
@@ -20,23 +27,102 @@ public:
   float scale;
   Material *material;
   bool visible;
+  // Current level of detail, -1 until the first selectLOD( )
+  int lod;
 
   UtahTeapot(glm::vec3 pos, float s, Material* m): position(pos), scale(s){
     material = m;
     visible = true;
+    lod = -1;
   }
   
   UtahTeapot( ):position(glm::vec3(0, 0, 0)), scale(1.0){
     material = new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), glm::vec4(0.5, 0.5, 0.5, 1.0), glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0);
     visible = true;
+    lod = -1;
   }
   
   ~UtahTeapot( ){
     delete material;
   }
 
+  // Tessellation of the patches used by draw( ), the same as
+  // _glutSolidTeapot's.
+  static const int GRID = 7;
+
+  // The teapot baked at a grid resolution. Each resolution is
+  // tessellated once, the first time it is asked for, and kept for
+  // the life of the program.
+  static Mesh& mesh(int grid = GRID){
+    static std::map<int, Mesh*> cache;
+    Mesh*& m = cache[grid];
+    if(!m){
+      std::vector<Vertex> vertices(_glutTeapotVertexCount(grid));
+      std::vector<GLuint> indices(_glutTeapotIndexCount(grid));
+      _glutTessellateTeapot(grid, vertices[0].position, &indices[0]);
+      m = new Mesh( );
+      m->upload(&vertices[0], vertices.size( ), &indices[0], indices.size( ));
+    }
+    return *m;
+  }
+
+  // Levels of detail, finest first
+  static const int LOD_COUNT = 4;
+
+  static int lodGrid(int level){
+    static const int grids[LOD_COUNT] = {28, 14, 7, 3};
+    return grids[level];
+  }
+
+  static Mesh& lodMesh(int level){
+    return mesh(lodGrid(level));
+  }
+
+  // Radius of a sphere about the origin enclosing the unit teapot
+  static float boundingRadius( ){
+    return 1.785f;
+  }
+
+  // Picks the level of detail for a teapot whose bounding sphere
+  // covers pixelRadius pixels on screen, so that a grid cell spans
+  // about pixelsPerCell pixels; a body patch is a quarter turn around
+  // the teapot. Finer levels are taken as soon as they are needed,
+  // coarser ones only once the teapot is a HYSTERESIS fraction below
+  // the switch point, so a teapot hovering at a boundary does not pop
+  // back and forth.
+  int selectLOD(float pixelRadius, float pixelsPerCell = 8.0f){
+    lod = chooseLOD(pixelRadius, lod, pixelsPerCell);
+    return lod;
+  }
+
+  // The level selectLOD( ) moves to from current, which is -1 when
+  // there is none yet.
+  static int chooseLOD(float pixelRadius, int current, float pixelsPerCell = 8.0f){
+    static const float HYSTERESIS = 0.2f;
+    float required = 0.5f * float(M_PI) * pixelRadius / pixelsPerCell;
+    int level = LOD_COUNT - 1;
+    while(level > 0 && lodGrid(level) < required){
+      level--;
+    }
+    while(current >= 0 && level > current && required > lodGrid(level) * (1.0f - HYSTERESIS)){
+      level--;
+    }
+    return level;
+  }
+
+  // Selects the level of detail from the teapot's distance along the
+  // view direction as seen by camera through viewMatrix.
+  int selectLOD(Camera& camera, const glm::mat4& viewMatrix, int viewportHeight){
+    float distance = -(viewMatrix * glm::vec4(position, 1.0)).z;
+    return selectLOD(camera.projectedRadius(boundingRadius( ) * scale, distance, viewportHeight));
+  }
+
+  // One indexed draw of the baked mesh at the current level of
+  // detail, or at GRID before one has been selected. The mesh is the
+  // teapot at unit scale; position and scale belong in the caller's
+  // model matrix.
   void draw( ){
-    _glutSolidTeapot(scale);
+    (lod < 0 ? mesh( ) : lodMesh(lod)).draw( );
   }
 
   void debug( ){
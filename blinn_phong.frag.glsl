@@ -15,13 +15,29 @@
  *
  */
 
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 2
+#endif
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
+// Matches LightClusters::MAX_PER_CLUSTER
+#ifndef MAX_CLUSTER_LIGHTS
+#define MAX_CLUSTER_LIGHTS 64
+#endif
+
+varying vec3 myPosition;
 varying vec3 myNormal;
-varying vec4 myVertex;
+#if TEXTURED
+varying vec2 myTexCoord;
+#endif
 
 // These are passed in from the CPU program
-uniform mat4 modelViewMatrix;
-uniform mat4 projectionMatrix;
-uniform mat4 normalMatrix;
 // Information about the lights
 uniform vec4 light0_position;
 uniform vec4 light0_color;
@@ -32,8 +48,29 @@ uniform vec4 ambient;
 uniform vec4 diffuse;
 uniform vec4 specular;
 uniform float shininess;
+#if TEXTURED
 // Texture
-uniform sampler2D texture;
+uniform sampler2D textureImage;
+#endif
+
+#if CLUSTERED
+// Lights binned into clusters of the view volume; see LightClusters.h
+uniform sampler2D clusterLights;
+uniform sampler2D clusterGrid;
+uniform sampler2D clusterIndices;
+// Tiles per pixel in x and y, then the scale and bias from the log
+// of eye space depth to a slice
+uniform vec4 clusterScale;
+// Tiles in x and y, slices, and the width of the cluster textures
+uniform vec4 clusterSize;
+// Rows of the light, grid and index textures
+uniform vec4 clusterRows;
+
+vec4 clusterFetch(sampler2D data, const in float i, const in float rows){
+  vec2 texel = vec2(mod(i, clusterSize.w), floor(i / clusterSize.w)) + 0.5;
+  return texture2D(data, texel / vec2(clusterSize.w, rows));
+}
+#endif
 
 vec4 computeLight(const in vec3 direction, const in vec4 lightcolor, const in vec3 normal, const in vec3 reflection){
 
@@ -49,32 +86,59 @@ vec4 computeLight(const in vec3 direction, const in vec4 lightcolor, const in ve
 
 void main (void){
 
-  // They eye is always at (0,0,0) looking down -z axis 
-  // Also compute current fragment position and direction to eye 
-
+  // The eye is always at (0,0,0) looking down -z axis; the vertex
+  // shader has already moved the fragment into eye space.
   const vec3 eyepos = vec3(0,0,0);
-  vec4 _mypos = modelViewMatrix * myVertex;
-  vec3 mypos = _mypos.xyz / _mypos.w;
-  vec3 eyedirn = normalize(eyepos - mypos);
+  vec3 eyedirn = normalize(eyepos - myPosition);
+  vec3 normal = normalize(myNormal);
 
-  // Compute normal, needed for shading. 
-  vec4 _normal = normalMatrix * vec4(myNormal, 0.0);
-  vec3 normal = normalize(_normal.xyz);
+  vec4 finalColor = ambient;
 
+#if LIGHT_COUNT > 0
   // Light 0, point
   vec3 position0 = light0_position.xyz / light0_position.w;
-  vec3 direction0 = normalize(position0 - mypos);
+  vec3 direction0 = normalize(position0 - myPosition);
   vec3 half0 = normalize(direction0 + eyedirn);
 
-  vec4 color0 = computeLight(direction0, light0_color, normal, half0) ;
+  finalColor += computeLight(direction0, light0_color, normal, half0);
+#endif
 
-  // Light 1, point 
+#if LIGHT_COUNT > 1
+  // Light 1, point
   vec3 position1 = light1_position.xyz / light1_position.w;
-  vec3 direction1 = normalize(position1 - mypos);
+  vec3 direction1 = normalize(position1 - myPosition);
   vec3 half1 = normalize(direction1 + eyedirn); 
 
-  vec4 color1 = computeLight(direction1, light1_color, normal, half1) ;
-  
-  vec4 finalColor = ambient + color0 + color1;
-  gl_FragColor = texture2D(texture, gl_TexCoord[0].st) * finalColor;
+  finalColor += computeLight(direction1, light1_color, normal, half1);
+#endif
+
+#if CLUSTERED
+  // Only the lights binned into this fragment's cluster
+  vec2 tile = min(floor(gl_FragCoord.xy * clusterScale.xy), clusterSize.xy - 1.0);
+  float slice = clamp(floor(log(-myPosition.z) * clusterScale.z + clusterScale.w), 0.0, clusterSize.z - 1.0);
+  vec4 cluster = clusterFetch(clusterGrid, tile.x + clusterSize.x * (tile.y + clusterSize.y * slice), clusterRows.y);
+  for(int i = 0; i < MAX_CLUSTER_LIGHTS; i++){
+    if(float(i) >= cluster.y){
+      break;
+    }
+    float light = clusterFetch(clusterIndices, cluster.x + float(i), clusterRows.z).r;
+    vec4 positionRadius = clusterFetch(clusterLights, 2.0 * light, clusterRows.x);
+    vec4 lightColor = clusterFetch(clusterLights, 2.0 * light + 1.0, clusterRows.x);
+    vec3 toLight = positionRadius.xyz - myPosition;
+    vec3 direction = normalize(toLight);
+    // Smooth falloff to nothing at the radius; 0 means no falloff.
+    float attenuation = 1.0;
+    if(positionRadius.w > 0.0){
+      float fade = clamp(1.0 - dot(toLight, toLight) / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+      attenuation = fade * fade;
+    }
+    finalColor += computeLight(direction, lightColor * attenuation, normal, normalize(direction + eyedirn));
+  }
+#endif
+
+#if TEXTURED
+  gl_FragColor = texture2D(textureImage, myTexCoord) * finalColor;
+#else
+  gl_FragColor = finalColor;
+#endif
 }
@@ -15,19 +15,39 @@
  *
  */
 
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
 // These are passed in from the CPU program
 uniform mat4 modelViewMatrix;
 uniform mat4 projectionMatrix;
+uniform mat4 normalMatrix;
 
+// Generic vertex attributes from the mesh's vertex buffer; the
+// locations are bound by the CPU program before linking.
+attribute vec4 vertexPosition;
+attribute vec3 vertexNormal;
+attribute vec2 vertexTexCoord;
 
 // These are variables that we wish to send to our fragment shader
 // In later versions of GLSL, these are 'out' variables.
+// Eye space position and normal, computed once per vertex rather
+// than once per fragment
+varying vec3 myPosition;
 varying vec3 myNormal;
-varying vec4 myVertex;
+#if TEXTURED
+varying vec2 myTexCoord;
+#endif
 
 void main() {
-  gl_Position = projectionMatrix * modelViewMatrix * gl_Vertex;
-  myNormal = gl_Normal;
-  myVertex = gl_Vertex;
-  gl_TexCoord[0] = gl_MultiTexCoord0;
+  vec4 eyePosition = modelViewMatrix * vertexPosition;
+  gl_Position = projectionMatrix * eyePosition;
+  myPosition = eyePosition.xyz / eyePosition.w;
+  myNormal = (normalMatrix * vec4(vertexNormal, 0.0)).xyz;
+#if TEXTURED
+  myTexCoord = vertexTexCoord;
+#endif
 }
@@ -0,0 +1,39 @@
+#version 330 core
+/*
+ * blinn_phong.vert.glsl for OpenGL 3.3 core profile contexts, which
+ * do not accept GLSL 1.20. The attribute locations are fixed in the
+ * shader and match VertexAttribute in Mesh.h.
+ *
+ */
+
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
+uniform mat4 modelViewMatrix;
+uniform mat4 projectionMatrix;
+uniform mat4 normalMatrix;
+
+layout(location = 0) in vec4 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec2 vertexTexCoord;
+
+// Eye space position and normal, computed once per vertex rather
+// than once per fragment
+out vec3 myPosition;
+out vec3 myNormal;
+#if TEXTURED
+out vec2 myTexCoord;
+#endif
+
+void main() {
+  vec4 eyePosition = modelViewMatrix * vertexPosition;
+  gl_Position = projectionMatrix * eyePosition;
+  myPosition = eyePosition.xyz / eyePosition.w;
+  myNormal = (normalMatrix * vec4(vertexNormal, 0.0)).xyz;
+#if TEXTURED
+  myTexCoord = vertexTexCoord;
+#endif
+}
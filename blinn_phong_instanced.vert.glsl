@@ -0,0 +1,76 @@
+# version 120
+/*
+ * A Blinn-Phong vertex shader for instanced drawing.
+ *
+ * Each instance supplies a position, a per-axis scale and a
+ * material index. The model matrix is translate * scale, so the
+ * model-view and normal matrices are rebuilt here rather than
+ * uploaded per object, and the material is looked up in a
+ * palette of uniform arrays. The instance's image is a layer and
+ * a rectangle within a texture array.
+ *
+ * Lighting is done in eye space; the eye-space position and
+ * normal are passed to the fragment shader.
+ *
+ */
+
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
+// Must match MaterialLibrary::MAX_MATERIALS. Three vec4 per
+// material keeps the palette inside the GL 2.1 minimum of 128
+// vertex uniform vectors.
+const int MAX_MATERIALS = 32;
+
+// These are passed in from the CPU program once per frame
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+// Material palette; specular.w holds the shininess
+uniform vec4 materialAmbient[MAX_MATERIALS];
+uniform vec4 materialDiffuse[MAX_MATERIALS];
+uniform vec4 materialSpecular[MAX_MATERIALS];
+
+// Per-vertex attributes from the mesh
+attribute vec4 vertexPosition;
+attribute vec3 vertexNormal;
+attribute vec2 vertexTexCoord;
+
+// Per-instance attributes
+attribute vec3 instancePosition;
+attribute vec3 instanceScale;
+// x is the material index, y is the texture layer
+attribute vec2 instanceParams;
+// Offset and extent of the image within its layer
+attribute vec4 instanceTextureRect;
+
+varying vec3 myPosition;
+varying vec3 myNormal;
+#if TEXTURED
+// s, t and the texture array layer
+varying vec3 myTexCoord;
+#endif
+varying vec4 myAmbient;
+varying vec4 myDiffuse;
+varying vec4 mySpecular;
+
+void main() {
+  vec4 worldPosition = vec4(instancePosition + instanceScale * vertexPosition.xyz, 1.0);
+  vec4 eyePosition = viewMatrix * worldPosition;
+  gl_Position = projectionMatrix * eyePosition;
+  myPosition = eyePosition.xyz;
+  // The inverse transpose of a translate * scale matrix divides by the
+  // scale; the view matrix is a rigid transform so its own upper 3x3 is
+  // its inverse transpose.
+  myNormal = mat3(viewMatrix) * (vertexNormal / instanceScale);
+#if TEXTURED
+  myTexCoord = vec3(instanceTextureRect.xy + vertexTexCoord * instanceTextureRect.zw, instanceParams.y);
+#endif
+
+  int material = int(instanceParams.x);
+  myAmbient = materialAmbient[material];
+  myDiffuse = materialDiffuse[material];
+  mySpecular = materialSpecular[material];
+}
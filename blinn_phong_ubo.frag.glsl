@@ -0,0 +1,133 @@
+#version 140
+/*
+ * The instanced Blinn-Phong fragment shader with the lights read
+ * from the per-frame uniform block; see blinn_phong_ubo.vert.glsl.
+ *
+ */
+
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 2
+#endif
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
+// Matches LightClusters::MAX_PER_CLUSTER
+#ifndef MAX_CLUSTER_LIGHTS
+#define MAX_CLUSTER_LIGHTS 64
+#endif
+
+in vec3 myPosition;
+in vec3 myNormal;
+#if TEXTURED
+in vec3 myTexCoord;
+#endif
+in vec4 myAmbient;
+in vec4 myDiffuse;
+in vec4 mySpecular;
+
+// Shared with the vertex shader; lights are in eye space
+layout(std140) uniform FrameBlock{
+  mat4 viewMatrix;
+  mat4 projectionMatrix;
+  vec4 light0_position;
+  vec4 light0_color;
+  vec4 light1_position;
+  vec4 light1_color;
+};
+
+#if TEXTURED
+// Texture array holding every image; see TextureArray.h
+uniform sampler2DArray textureArray;
+#endif
+
+out vec4 fragColor;
+
+#if CLUSTERED
+// Lights binned into clusters of the view volume; see LightClusters.h
+uniform sampler2D clusterLights;
+uniform sampler2D clusterGrid;
+uniform sampler2D clusterIndices;
+// Tiles per pixel in x and y, then the scale and bias from the log
+// of eye space depth to a slice
+uniform vec4 clusterScale;
+// Tiles in x and y, slices, and the width of the cluster textures
+uniform vec4 clusterSize;
+
+vec4 clusterFetch(sampler2D data, const in int i){
+  int width = int(clusterSize.w);
+  return texelFetch(data, ivec2(i % width, i / width), 0);
+}
+#endif
+
+vec4 computeLight(const in vec3 direction, const in vec4 lightcolor, const in vec3 normal, const in vec3 reflection){
+
+  float nDotL = dot(normal, direction);
+  vec4 lambert = myDiffuse * lightcolor * max(nDotL, 0.0);
+
+  float nDotR = dot(normal, reflection);
+  vec4 phong = vec4(mySpecular.rgb, 1.0) * lightcolor * pow(max(nDotR, 0.0), mySpecular.w);
+
+  vec4 retval = lambert + phong;
+  return retval;
+}
+
+void main (void){
+
+  // The eye is always at (0,0,0) looking down -z axis
+  const vec3 eyepos = vec3(0,0,0);
+  vec3 eyedirn = normalize(eyepos - myPosition);
+  vec3 normal = normalize(myNormal);
+
+  vec4 finalColor = myAmbient;
+
+#if LIGHT_COUNT > 0
+  // Light 0, point
+  vec3 position0 = light0_position.xyz / light0_position.w;
+  vec3 direction0 = normalize(position0 - myPosition);
+  vec3 half0 = normalize(direction0 + eyedirn);
+
+  finalColor += computeLight(direction0, light0_color, normal, half0);
+#endif
+
+#if LIGHT_COUNT > 1
+  // Light 1, point
+  vec3 position1 = light1_position.xyz / light1_position.w;
+  vec3 direction1 = normalize(position1 - myPosition);
+  vec3 half1 = normalize(direction1 + eyedirn);
+
+  finalColor += computeLight(direction1, light1_color, normal, half1);
+#endif
+
+#if CLUSTERED
+  // Only the lights binned into this fragment's cluster
+  ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterScale.xy), ivec2(clusterSize.xy) - 1);
+  int slice = int(clamp(floor(log(-myPosition.z) * clusterScale.z + clusterScale.w), 0.0, clusterSize.z - 1.0));
+  vec4 cluster = clusterFetch(clusterGrid, tile.x + int(clusterSize.x) * (tile.y + int(clusterSize.y) * slice));
+  int first = int(cluster.x), count = min(int(cluster.y), MAX_CLUSTER_LIGHTS);
+  for(int i = 0; i < count; i++){
+    int light = int(clusterFetch(clusterIndices, first + i).r);
+    vec4 positionRadius = clusterFetch(clusterLights, 2 * light);
+    vec4 lightColor = clusterFetch(clusterLights, 2 * light + 1);
+    vec3 toLight = positionRadius.xyz - myPosition;
+    vec3 direction = normalize(toLight);
+    // Smooth falloff to nothing at the radius; 0 means no falloff.
+    float attenuation = 1.0;
+    if(positionRadius.w > 0.0){
+      float fade = clamp(1.0 - dot(toLight, toLight) / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+      attenuation = fade * fade;
+    }
+    finalColor += computeLight(direction, lightColor * attenuation, normal, normalize(direction + eyedirn));
+  }
+#endif
+
+#if TEXTURED
+  fragColor = texture(textureArray, myTexCoord) * finalColor;
+#else
+  fragColor = finalColor;
+#endif
+}
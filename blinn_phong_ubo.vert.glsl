@@ -0,0 +1,74 @@
+#version 140
+/*
+ * The instanced Blinn-Phong vertex shader with its per-frame and
+ * material uniforms in std140 uniform blocks; see UniformBuffer.h.
+ * Otherwise the same as blinn_phong_instanced.vert.glsl, which is
+ * used on contexts older than OpenGL 3.1.
+ *
+ */
+
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
+// Must match MaterialLibrary::MAX_MATERIALS.
+const int MAX_MATERIALS = 32;
+
+// Written once per frame
+layout(std140) uniform FrameBlock{
+  mat4 viewMatrix;
+  mat4 projectionMatrix;
+  vec4 light0_position;
+  vec4 light0_color;
+  vec4 light1_position;
+  vec4 light1_color;
+};
+
+// Material palette, uploaded once; specular.w holds the shininess
+layout(std140) uniform MaterialBlock{
+  vec4 materialAmbient[MAX_MATERIALS];
+  vec4 materialDiffuse[MAX_MATERIALS];
+  vec4 materialSpecular[MAX_MATERIALS];
+};
+
+// Per-vertex attributes from the mesh
+in vec4 vertexPosition;
+in vec3 vertexNormal;
+in vec2 vertexTexCoord;
+
+// Per-instance attributes
+in vec3 instancePosition;
+in vec3 instanceScale;
+// x is the material index, y is the texture layer
+in vec2 instanceParams;
+// Offset and extent of the image within its layer
+in vec4 instanceTextureRect;
+
+out vec3 myPosition;
+out vec3 myNormal;
+#if TEXTURED
+// s, t and the texture array layer
+out vec3 myTexCoord;
+#endif
+out vec4 myAmbient;
+out vec4 myDiffuse;
+out vec4 mySpecular;
+
+void main() {
+  vec4 worldPosition = vec4(instancePosition + instanceScale * vertexPosition.xyz, 1.0);
+  vec4 eyePosition = viewMatrix * worldPosition;
+  gl_Position = projectionMatrix * eyePosition;
+  myPosition = eyePosition.xyz;
+  // See blinn_phong_instanced.vert.glsl
+  myNormal = mat3(viewMatrix) * (vertexNormal / instanceScale);
+#if TEXTURED
+  myTexCoord = vec3(instanceTextureRect.xy + vertexTexCoord * instanceTextureRect.zw, instanceParams.y);
+#endif
+
+  int material = int(instanceParams.x);
+  myAmbient = materialAmbient[material];
+  myDiffuse = materialDiffuse[material];
+  mySpecular = materialSpecular[material];
+}
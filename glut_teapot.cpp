@@ -51,6 +51,7 @@ OpenGL(TM) is a trademark of Silicon Graphics, Inc.
 */
 
 //#include "glutint.h"
+#include <math.h>
 #include "glut_teapot.h"
 
 #ifdef __cplusplus 
@@ -205,7 +206,154 @@ teapot(GLint grid, GLdouble scale, GLenum type)
   glPopAttrib();
 }
 
+/* Baked tessellation.  The same 32 patches are evaluated once on the
+   CPU into an indexed triangle list, in the object space
+   _glutSolidTeapot(1.0) draws in. */
+
+#define TEAPOT_PATCHES 32
+
+static void
+bernstein(float t, float b[4], float db[4])
+{
+  float mt = 1.0 - t;
+
+  b[0] = mt * mt * mt;
+  b[1] = 3.0 * t * mt * mt;
+  b[2] = 3.0 * t * t * mt;
+  b[3] = t * t * t;
+  db[0] = -3.0 * mt * mt;
+  db[1] = 3.0 * mt * mt - 6.0 * t * mt;
+  db[2] = 6.0 * t * mt - 3.0 * t * t;
+  db[3] = 3.0 * t * t;
+}
+
+/* Position and unnormalized normal of patch c at (u, v); u runs along
+   k and v along j, as glMap2f is given them above.  The normal is
+   dP/du x dP/dv, which is what GL_AUTO_NORMAL computes. */
+static void
+evalPatch(float c[4][4][3], float u, float v, float pos[3], float nrm[3])
+{
+  float bu[4], dbu[4], bv[4], dbv[4], du[3], dv[3];
+  int j, k, l;
+
+  bernstein(u, bu, dbu);
+  bernstein(v, bv, dbv);
+  for (l = 0; l < 3; l++) {
+    pos[l] = du[l] = dv[l] = 0.0;
+    for (j = 0; j < 4; j++) {
+      for (k = 0; k < 4; k++) {
+        pos[l] += bu[k] * bv[j] * c[j][k][l];
+        du[l] += dbu[k] * bv[j] * c[j][k][l];
+        dv[l] += bu[k] * dbv[j] * c[j][k][l];
+      }
+    }
+  }
+  nrm[0] = du[1] * dv[2] - du[2] * dv[1];
+  nrm[1] = du[2] * dv[0] - du[0] * dv[2];
+  nrm[2] = du[0] * dv[1] - du[1] * dv[0];
+}
+
+static void
+bakePatch(float c[4][4][3], GLint grid, GLfloat *vertices, GLuint *indices, GLuint base)
+{
+  float pos[3], nrm[3], inside[3], u, v, len, nudge;
+  int i, j;
+
+  for (j = 0; j <= grid; j++) {
+    for (i = 0; i <= grid; i++) {
+      u = (float) i / grid;
+      v = (float) j / grid;
+      evalPatch(c, u, v, pos, nrm);
+      len = sqrt(nrm[0] * nrm[0] + nrm[1] * nrm[1] + nrm[2] * nrm[2]);
+      /* Where a row of control points collapses to a point (the lid's
+         knob and the bottom's center) one derivative vanishes; take
+         the normal from just inside the patch instead. */
+      for (nudge = 1.0e-3; len < 1.0e-6 && nudge < 0.1; nudge *= 4.0) {
+        evalPatch(c, u + (u < 0.5 ? nudge : -nudge),
+          v + (v < 0.5 ? nudge : -nudge), inside, nrm);
+        len = sqrt(nrm[0] * nrm[0] + nrm[1] * nrm[1] + nrm[2] * nrm[2]);
+      }
+      if (len == 0.0)
+        len = 1.0;
+      /* glRotatef(270, 1, 0, 0), glScalef(0.5), glTranslatef(0, 0, -1.5) */
+      vertices[0] = 0.5 * pos[0];
+      vertices[1] = 0.5 * (pos[2] - 1.5);
+      vertices[2] = -0.5 * pos[1];
+      vertices[3] = nrm[0] / len;
+      vertices[4] = nrm[2] / len;
+      vertices[5] = -nrm[1] / len;
+      vertices[6] = u;
+      vertices[7] = v;
+      vertices += 8;
+    }
+  }
+  for (j = 0; j < grid; j++) {
+    for (i = 0; i < grid; i++) {
+      GLuint a = base + j * (grid + 1) + i;
+      GLuint d = a + grid + 1;
+
+      indices[0] = a;
+      indices[1] = a + 1;
+      indices[2] = d + 1;
+      indices[3] = a;
+      indices[4] = d + 1;
+      indices[5] = d;
+      indices += 6;
+    }
+  }
+}
+
 /* CENTRY */
+int GLUTAPIENTRY
+_glutTeapotVertexCount(GLint grid)
+{
+  return TEAPOT_PATCHES * (grid + 1) * (grid + 1);
+}
+
+int GLUTAPIENTRY
+_glutTeapotIndexCount(GLint grid)
+{
+  return TEAPOT_PATCHES * grid * grid * 6;
+}
+
+void GLUTAPIENTRY
+_glutTessellateTeapot(GLint grid, GLfloat *vertices, GLuint *indices)
+{
+  float p[4][4][3], q[4][4][3], r[4][4][3], s[4][4][3];
+  float (*patches[4])[4][3];
+  long i, j, k, l, n, patch = 0;
+
+  patches[0] = p;
+  patches[1] = q;
+  patches[2] = r;
+  patches[3] = s;
+  for (i = 0; i < 10; i++) {
+    /* The same reflections as teapot( ) */
+    for (j = 0; j < 4; j++) {
+      for (k = 0; k < 4; k++) {
+        for (l = 0; l < 3; l++) {
+          p[j][k][l] = cpdata[patchdata[i][j * 4 + k]][l];
+          q[j][k][l] = cpdata[patchdata[i][j * 4 + (3 - k)]][l];
+          if (l == 1)
+            q[j][k][l] *= -1.0;
+          r[j][k][l] = cpdata[patchdata[i][j * 4 + (3 - k)]][l];
+          if (l == 0)
+            r[j][k][l] *= -1.0;
+          s[j][k][l] = cpdata[patchdata[i][j * 4 + k]][l];
+          if (l == 0 || l == 1)
+            s[j][k][l] *= -1.0;
+        }
+      }
+    }
+    for (n = 0; n < (i < 6 ? 4 : 2); n++, patch++) {
+      bakePatch(patches[n], grid,
+        vertices + patch * (grid + 1) * (grid + 1) * 8,
+        indices + patch * grid * grid * 6,
+        patch * (grid + 1) * (grid + 1));
+    }
+  }
+}
+
 void GLUTAPIENTRY 
 _glutSolidTeapot(GLdouble scale)
 {
@@ -36,6 +36,17 @@ void _glutSolidTeapot(GLdouble scale);
 
 void _glutWireTeapot(GLdouble scale);
 
+/* Sizes of the arrays _glutTessellateTeapot fills for a given grid. */
+int _glutTeapotVertexCount(GLint grid);
+
+int _glutTeapotIndexCount(GLint grid);
+
+/* Evaluates the teapot's patches once on a grid x grid lattice each
+   into interleaved vertices (position[3], normal[3], texture
+   coordinate[2]) and triangle indices, in the object space of
+   _glutSolidTeapot(1.0). */
+void _glutTessellateTeapot(GLint grid, GLfloat *vertices, GLuint *indices);
+
 #ifdef __cplusplus
 }
 #endif
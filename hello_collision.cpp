@@ -8,16 +8,26 @@
 #include <tuple>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/gtc/matrix_inverse.hpp>
 
+// Built with HEADLESS the scene is drawn offscreen through EGL; see
+// EGLApp.h.
+#ifdef HEADLESS
+#include "EGLApp.h"
+typedef EGLApp App;
+#else
 #include "GLFWApp.h"
+typedef GLFWApp App;
+#endif
 #include "GLSLShader.h"
 #include "glut_teapot.h"
 
@@ -25,6 +35,19 @@
 #include "Camera.h"
 #include "UtahTeapot.h"
 #include "Square.h"
+#include "InstanceBatch.h"
+#include "TextureArray.h"
+#include "DrawList.h"
+#include "QuadTree.h"
+#include "UniformBuffer.h"
+#include "TeapotField.h"
+#include "ProgramCache.h"
+#include "ShaderVariant.h"
+#include "FileWatcher.h"
+#include "LightClusters.h"
+#include "TransformHierarchy.h"
+#include "FrameCapture.h"
+#include "TextureCache.h"
 
 void msglVersion(void){
   fprintf(stderr, "OpenGL Version Information:\n");
@@ -36,7 +59,7 @@ void msglVersion(void){
 }
 
 
-class CollisionDetectionApp : public GLFWApp{
+class CollisionDetectionApp : public App{
 private:
   float rotationDelta;
 
@@ -50,113 +73,364 @@ private:
   glm::mat4 modelViewMatrix;
   glm::mat4 projectionMatrix;
   glm::mat4 normalMatrix;
+  // Model view and normal matrices of the per-object path. Node 0 is
+  // the scene; under it are the walls, the squares and the teapots,
+  // in that order, so a wall or square's node is 1 plus its draw list
+  // payload. Only squares move, so only their matrices are recomputed
+  // while the camera is still.
+  TransformHierarchy transforms;
+  enum{ SCENE_NODE = 0 };
   
-  GLSLProgram shaderProgram;
+  // Uniform locations of one shader variant; -1 for those it lacks
+  struct ProgramUniforms{
+    GLint modelViewMatrix;
+    GLint projectionMatrix;
+    GLint normalMatrix;
+    GLint viewMatrix;
+    GLint light0_position;
+    GLint light0_color;
+    GLint light1_position;
+    GLint light1_color;
+    GLint ambient;
+    GLint diffuse;
+    GLint specular;
+    GLint shininess;
+    GLint materialAmbient;
+    GLint materialDiffuse;
+    GLint materialSpecular;
+    GLint texture;
+    GLint clusterLights;
+    GLint clusterGrid;
+    GLint clusterIndices;
+    GLint clusterScale;
+    GLint clusterSize;
+    GLint clusterRows;
+
+    void locate(GLuint program, const ShaderKey& key){
+      modelViewMatrix = glGetUniformLocation(program, "modelViewMatrix");
+      projectionMatrix = glGetUniformLocation(program, "projectionMatrix");
+      normalMatrix = glGetUniformLocation(program, "normalMatrix");
+      viewMatrix = glGetUniformLocation(program, "viewMatrix");
+      light0_position = glGetUniformLocation(program, "light0_position");
+      light0_color = glGetUniformLocation(program, "light0_color");
+      light1_position = glGetUniformLocation(program, "light1_position");
+      light1_color = glGetUniformLocation(program, "light1_color");
+      ambient = glGetUniformLocation(program, "ambient");
+      diffuse = glGetUniformLocation(program, "diffuse");
+      specular = glGetUniformLocation(program, "specular");
+      shininess = glGetUniformLocation(program, "shininess");
+      materialAmbient = glGetUniformLocation(program, "materialAmbient");
+      materialDiffuse = glGetUniformLocation(program, "materialDiffuse");
+      materialSpecular = glGetUniformLocation(program, "materialSpecular");
+      texture = glGetUniformLocation(program, key.instanced ? "textureArray" : "textureImage");
+      clusterLights = glGetUniformLocation(program, "clusterLights");
+      clusterGrid = glGetUniformLocation(program, "clusterGrid");
+      clusterIndices = glGetUniformLocation(program, "clusterIndices");
+      clusterScale = glGetUniformLocation(program, "clusterScale");
+      clusterSize = glGetUniformLocation(program, "clusterSize");
+      clusterRows = glGetUniformLocation(program, "clusterRows");
+    }
+  };
+  typedef ShaderVariant<ProgramUniforms> Program;
+
+  // Every program is a variant of the Blinn-Phong shaders, built the
+  // first time a draw needs it; see shaderKey( ).
+  ShaderVariants<ProgramUniforms> programs;
+  // Linked programs are kept on disk between runs when the driver
+  // can hand them back.
+  ProgramCache programCache;
+  bool useProgramCache;
+  // Edited shader sources are rebuilt and swapped in while running.
+  FileWatcher shaderWatcher;
+  std::vector<std::string> changedFiles;
+  std::vector<ShaderKey> reloadedPrograms;
+  // Point lights in the scene
+  static const unsigned int lightCount = 2;
+  // With -l, that many more small point lights, which with the two
+  // above are binned into clusters and shaded only where they reach
+  unsigned int pointLightCount;
+  bool useClusters;
+  LightClusters lightClusters;
+
+  GLStateCache& glState;
 
   SpinningLight light0;
   SpinningLight light1; 
 
-  UtahTeapot* teapots[20];
-  const int teapotCount = 20;
+  // Keyed into drawList with one mesh per level of detail
+  TeapotField teapots;
+  unsigned int teapotCount;
 
-  Square* squares[10];
-  const unsigned int squareCount = 10;
+  std::vector<Square*> squares;
+  unsigned int squareCount;
 
   Square* boundingBox[4];
 
-  Texture *texhappyface, *texwhitesquare;
+  // Squares and walls refer to materials by index into this palette
+  MaterialLibrary materials;
+  const int wallMaterial = 0;
+
+  // Draw every wall and every square with one instanced draw when the
+  // context supports it; otherwise draw one object at a time.
+  bool useInstancing;
+  InstanceBatch batch;
+
+  // Walls, squares and teapots are drawn in the order of their sort
+  // keys. Payloads below 4 are walls, the next squares.size( ) index
+  // squares and the rest teapots; see drawable( ) and isTeapot( ).
+  DrawList drawList;
+  // Bounding boxes of the squares, indexed like squares. The quadtree
+  // over them finds the pairs that may collide and the squares that
+  // may be in view.
+  AABBBatch squareBounds;
+  QuadTree broadphase;
+  std::vector<uint32_t> visibleSquares;
+  // Mesh indices used in the sort keys, a teapot's being MESH_TEAPOT
+  // plus its level of detail; the program index is the ShaderKey's.
+  enum{ MESH_QUAD = 0, MESH_TEAPOT = 1 };
+
+  // On OpenGL 3.1 and later the instanced program reads the per-frame
+  // values and the material palette from uniform buffers.
+  bool useUniformBuffers;
+  UniformBuffer frameUniforms;
+  UniformBuffer materialUniforms;
+
+  // Squares and walls refer to images by index into textureFiles;
+  // the per-object path binds one Texture per image and the instanced
+  // path samples them all from one TextureArray. The Textures come
+  // from textureCache, so a reset reuses them. Either way the images
+  // are decoded in the background by textureLoader, and are plain
+  // white until then.
+  std::vector<std::string> textureFiles;
+  const int wallTexture = 0;
+  AsyncTextureLoader textureLoader;
+  TextureCache textureCache;
+  std::vector<TextureCache::Handle> textures;
+  TextureArray textureArray;
 
   bool debugMaterialFlag;
 
-  // Variables to set uniform params for lighting fragment shader 
-  unsigned int uModelViewMatrix;
-  unsigned int uProjectionMatrix;
-  unsigned int uNormalMatrix;
-  unsigned int uLight0_position;
-  unsigned int uLight0_color;
-  unsigned int uLight1_position;
-  unsigned int uLight1_color;
-  unsigned int uAmbient;
-  unsigned int uDiffuse;
-  unsigned int uSpecular;
-  unsigned int uShininess;
-  unsigned int uTexture;
+  bool forcePerObject;
+
+  // Print the render-state cache counters every statsInterval frames
+  bool printStats;
+  unsigned int frameCount;
+  static const unsigned int statsInterval = 100;
+
+  // Render this many frames after the first, report the time per
+  // frame and quit; 0 runs interactively.
+  unsigned int benchmarkFrames;
+  double benchmarkStart;
+  // A headless build has no window to close, so it always times a run
+  static const unsigned int headlessFrames = 300;
+
+  // How frames are paced when not benchmarking; see FramePacer.h
+  FramePacer::pacemode_t pacing;
+  double targetRate;
+
+  // Frames are recorded to capturePath from the start when it is set,
+  // and 'P' saves a screenshot.
+  FrameCapture capture;
+  std::string capturePath;
   
+  static const char* options( ){
+    return "n:t:psb:cl:o:v:f:";
+  }
+
+  // The context is created before the options are parsed in the
+  // constructor's body, so -c is looked for ahead of time.
+  static profile_t requestedProfile(int argc, char* argv[]){
+    profile_t profile = COMPATIBILITY;
+    int c;
+    opterr = 0;
+    while((c = getopt(argc, argv, options( ))) != -1){
+      if(c == 'c'){
+        profile = CORE;
+      }
+    }
+    opterr = 1;
+    optind = 1;
+    return profile;
+  }
+
+  CollisionDetectionApp(int argc, char* argv[], profile_t profile) :
+    App(argc, argv, std::string("Collision Detection").c_str( ), 
+            600, 600, profile == CORE ? 3 : 2, profile == CORE ? 3 : 1,
+            std::make_tuple(100, 100), profile), useProgramCache(false), pointLightCount(0), useClusters(false), glState(GLStateCache::current( )),
+            teapotCount(20), squareCount(10), useUniformBuffers(false), frameUniforms(FRAME_BLOCK), materialUniforms(MATERIAL_BLOCK), forcePerObject(false),
+            printStats(false), frameCount(0), benchmarkFrames(0), benchmarkStart(0.0),
+            pacing(FramePacer::VSYNC), targetRate(60.0){
+    int c;
+    while((c = getopt(argc, argv, options( ))) != -1){
+      switch(c){
+      case 'n':
+        squareCount = (unsigned int)atoi(optarg);
+        break;
+      case 'p':
+        forcePerObject = true;
+        break;
+      case 't':
+        teapotCount = (unsigned int)atoi(optarg);
+        break;
+      case 's':
+        printStats = true;
+        break;
+      case 'b':
+        benchmarkFrames = (unsigned int)atoi(optarg);
+        break;
+      case 'c':
+        // Handled by requestedProfile( )
+        break;
+      case 'l':
+        pointLightCount = (unsigned int)atoi(optarg);
+        break;
+      case 'o':
+        capturePath = optarg;
+        break;
+      case 'v':
+        if(!strcmp(optarg, "uncapped")){
+          pacing = FramePacer::UNCAPPED;
+        }else if(!strcmp(optarg, "vsync")){
+          pacing = FramePacer::VSYNC;
+        }else if(!strcmp(optarg, "adaptive")){
+          pacing = FramePacer::ADAPTIVE;
+        }else{
+          fprintf(stderr, "No such pacing mode: %s\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'f':
+        targetRate = atof(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n squares] [-t teapots] [-p] [-s] [-b frames] [-c] [-l lights] [-o path] [-v pacing] [-f fps]\n", argv[0]);
+        fprintf(stderr, "\t-n squares\tnumber of bouncing squares (default 10)\n");
+        fprintf(stderr, "\t-t teapots\tnumber of teapots (default 20)\n");
+        fprintf(stderr, "\t-p\t\tdraw one object at a time instead of instancing\n");
+        fprintf(stderr, "\t-s\t\tprint GL state call statistics every %u frames\n", statsInterval);
+        fprintf(stderr, "\t-b frames\ttime this many frames without vsync, then quit\n");
+        fprintf(stderr, "\t-c\t\tuse an OpenGL 3.3 core profile context\n");
+        fprintf(stderr, "\t-l lights\tadd this many point lights, shaded with clustered lighting\n");
+        fprintf(stderr, "\t-o path\t\trecord every frame to path.y4m, or to path00000.png and on\n");
+        fprintf(stderr, "\t-v pacing\tuncapped, vsync (default) or adaptive\n");
+        fprintf(stderr, "\t-f fps\t\tframe rate to cap uncapped to and to judge late frames by (default 60, 0 for none)\n");
+        exit(1);
+      }
+    }
+#ifdef HEADLESS
+    if(benchmarkFrames == 0){
+      benchmarkFrames = headlessFrames;
+    }
+#endif
+  }
+
 public:
   CollisionDetectionApp(int argc, char* argv[]) :
-    GLFWApp(argc, argv, std::string("Collision Detection").c_str( ), 
-            600, 600){ }
+    CollisionDetectionApp(argc, argv, requestedProfile(argc, argv)){ }
   
   void initCenterPosition( ){
     centerPosition = glm::vec3(0.0, 0.0, 0.0);
   }
   
+  // Scatters the teapots through the space behind the walls, shrinking
+  // them as their number grows so they stay about as far apart.
   void initTeapots( ){
-    std::srand(time(NULL));
-    for(int i = 0; i < teapotCount; i++){
+    teapots.clear( );
+    float volume = M_PI * 30.0 * 30.0 * 26.0;
+    float scale = glm::clamp(0.3f * float(cbrt(volume / teapotCount)), 0.05f, 1.0f);
+    for(unsigned int i = 0; i < teapotCount; i++){
+      glm::vec2 xy = glm::diskRand(30.0f);
+      glm::vec3 position = glm::vec3(xy, glm::linearRand(-28.0f, -2.0f));
+      teapots.add(position, scale, 1 + rand( ) % (materials.size( ) - 1));
+    }
+    printf("%u teapots of scale %.3f\n", teapotCount, scale);
+  }
+
+  void initMaterials( ){
+    materials.clear( );
+    // The walls are white
+    materials.add(new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), glm::vec4(1.0, 1.0, 1.0, 1.0), glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0));
+    // The rest of the palette are random colors for the squares
+    while(materials.size( ) < MaterialLibrary::MAX_MATERIALS){
       glm::vec3 _diffuseColor = glm::linearRand(glm::vec3(0.2), glm::vec3(1.0));
-      //std::cerr << glm::to_string(_diffuseColor) << std::endl;
       glm::vec4 diffuseColor = glm::vec4(_diffuseColor, 1.0);
-      Material* m = new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), diffuseColor, glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0);
-      glm::vec2 xy = glm::diskRand(30.0);
-      glm::vec3 position = glm::vec3(xy, 0.0);
-      teapots[i] = new UtahTeapot(position, 1.0, m);
-      teapots[i]->visible = true;
+      materials.add(new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), diffuseColor, glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0));
     }
   }
 
+  void initTextureFiles( ){
+    textureFiles.clear( );
+    textureFiles.push_back("textures/whitesquare.png");
+    textureFiles.push_back("textures/awesomeface.png");
+    textureFiles.push_back("textures/unawesomeface.png");
+  }
+
   void initSquares() {
-    texhappyface = new Texture("textures/awesomeface.png");
-    texwhitesquare = new Texture("textures/whitesquare.png");
+    // The new handles are taken before the old ones are dropped, so
+    // textures still in use are not freed and loaded again.
+    // Instanced draws sample textureArray instead.
+    std::vector<TextureCache::Handle> loaded;
+    for(int i = 0; !useInstancing && i < textureFiles.size( ); i++){
+      loaded.push_back(textureCache.get(textureFiles[i], textureLoader));
+    }
+    textures.swap(loaded);
     std::srand(time(NULL));
+    for(int i = 0; i < squares.size( ); i++){
+      delete squares[i];
+    }
+    squares.clear( );
+    // Lay the squares out on a jittered grid inside the walls so they
+    // start apart without testing every pair; shrink them when there
+    // are too many to fit at unit size.
+    int columns = int(ceil(sqrt(double(squareCount))));
+    float cell = 14.0 / columns;
+    float side = glm::min(1.0f, 0.5f * cell);
     for(int i = 0; i < squareCount; i++){
-      glm::vec3 _diffuseColor = glm::linearRand(glm::vec3(0.2), glm::vec3(1.0));
-      glm::vec4 diffuseColor = glm::vec4(_diffuseColor, 1.0);
-      Material* m = new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), diffuseColor, glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0);
-      //squares[i]->texture = t;
-      glm::vec2 xy = glm::diskRand(0.3);
+      int m = 1 + rand( ) % (materials.size( ) - 1);
+      glm::vec2 jitter = glm::linearRand(glm::vec2(-0.5 * (cell - side)), glm::vec2(0.5 * (cell - side)));
+      glm::vec2 xy = glm::vec2(-7.0 + (i % columns + 0.5) * cell, -7.0 + (i / columns + 0.5) * cell) + jitter;
       glm::vec3 position = glm::vec3(xy, 0.0);
-      squares[i] = new Square(position, glm::vec3(1.0), m);
+      Square* square = new Square(position, glm::vec3(side, side, 1.0), materials[m]);
+      square->materialID = m;
+      // Every square but the walls' image is fair game
+      square->textureID = 1 + rand( ) % (textureFiles.size( ) - 1);
       float randSpeedFactor = 0.001 + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(0.100-0.001)));
-      squares[i]->speedFactor = randSpeedFactor;
-      squares[i]->visible = true;
-      for(int j = 0; j < i; j++) {
-        while(squares[i]->isColliding(*squares[j])) {
-          glm::vec2 xy = glm::diskRand(3.0);
-          position = glm::vec3(xy, 0.0);
-          squares[i]->position = position;
-          printf("square%i.isColliding(square%i), regenerating coordinates\n", i, j);
-        }
-      }
-      squares[i]->velocity = -glm::normalize(position);
-      printf("square #: %i, visible: %i, position: %.2f, %.2f, %.2f\n", i, squares[i]->visible, position.x, position.y, position.z);
-      std::cerr << glm::to_string(_diffuseColor) << std::endl;
+      square->speedFactor = randSpeedFactor;
+      square->visible = true;
+      square->velocity = glm::length(position) > 0.0 ? -glm::normalize(position) : glm::vec3(glm::circularRand(1.0f), 0.0);
+      squares.push_back(square);
     }
-    
-    /*
-    glm::vec4 diffuseColor = glm::vec4(0.5, 0.0, 0.0, 1.0);
-    Material* m0 = new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), diffuseColor, glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0);
-    glm::vec3 position = glm::vec3(-1.54, 0.82, 0.0);
-    //glm::vec3 position = glm::vec3(-0.68, 1.60, 0.0);
-    squares[0] = new Square(position, 1.0, m0);
+    printf("%u squares of side %.3f\n", squareCount, side);
+  }
 
-    diffuseColor = glm::vec4(0.0, 0.5, 0.0, 1.0);
-    Material* m1 = new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), diffuseColor, glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0);
-    position = glm::vec3(-0.68, 1.60, 0.0);
-    //position = glm::vec3(-1.54, 0.82, 0.0);
-    squares[1] = new Square(position, 1.0, m1);
+  void initBoundingBox() {
+    Material* m = materials[wallMaterial];
+    // The z scale is 1 rather than 0 so the normal matrix is invertible.
+    boundingBox[0] = new Square(glm::vec3(- 8.0,  0.0,  0.0), glm::vec3(1.0, 18.0, 1.0), m);  //left
+    boundingBox[1] = new Square(glm::vec3(  0.0,  8.0,  0.0), glm::vec3(18.0, 1.0, 1.0), m);  //top
+    boundingBox[2] = new Square(glm::vec3(  8.0,  0.0,  0.0), glm::vec3(1.0, 18.0, 1.0), m);  //right
+    boundingBox[3] = new Square(glm::vec3(  0.0, -8.0,  0.0), glm::vec3(18.0, 1.0, 1.0), m);  //bottom
+    for(int i = 0; i < 4; i++){
+      boundingBox[i]->materialID = wallMaterial;
+      boundingBox[i]->textureID = wallTexture;
+    }
+  }
 
-    printf("redSquare.isColliding(greenSquare): %i\n", squares[0]->isColliding(*squares[1]));
-    */
+  void initTransforms( ){
+    transforms.clear( );
+    transforms.add(glm::mat4(1.0f));
+    for(uint32_t i = 0; i < 4 + squares.size( ); i++){
+      Square* obj = drawable(i);
+      transforms.add(TransformHierarchy::translateScale(obj->position, obj->scale), SCENE_NODE);
+    }
+    for(size_t i = 0; i < teapots.size( ); i++){
+      const TeapotInstance& t = teapots[i];
+      transforms.add(TransformHierarchy::translateScale(t.position, glm::vec3(t.scale)), SCENE_NODE);
+    }
   }
 
-  void initBoundingBox() {
-    glm::vec4 diffuseColor = glm::vec4(1.0, 1.0, 1.0, 1.0);
-    Material* m = new Material(glm::vec4(0.2, 0.2, 0.2, 1.0), diffuseColor, glm::vec4(1.0, 1.0, 1.0, 1.0), 100.0);
-    boundingBox[0] = new Square(glm::vec3(- 8.0,  0.0,  0.0), glm::vec3(1.0, 18.0, 0.0), m);  //left
-    boundingBox[1] = new Square(glm::vec3(  0.0,  8.0,  0.0), glm::vec3(18.0, 1.0, 0.0), m);  //top
-    boundingBox[2] = new Square(glm::vec3(  8.0,  0.0,  0.0), glm::vec3(1.0, 18.0, 0.0), m);  //right
-    boundingBox[3] = new Square(glm::vec3(  0.0, -8.0,  0.0), glm::vec3(18.0, 1.0, 0.0), m);  //bottom
+  uint32_t drawableNode(uint32_t payload) const{
+    return 1 + payload;
   }
 
   void initCamera( ){
@@ -180,140 +454,323 @@ public:
     light1 = SpinningLight(color1, position1, centerPosition);
   }
 
+  // The two spinning lights come first and reach everywhere; they are
+  // moved into place every frame. The rest are scattered through the
+  // scene like the teapots, each lighting a few units around it.
+  void initPointLights( ){
+    lightClusters.clear( );
+    PointLight light;
+    light.radius = 0.0;
+    for(int i = 0; i < 2; i++){
+      lightClusters.add(light);
+    }
+    for(unsigned int i = 0; i < pointLightCount; i++){
+      glm::vec2 xy = glm::diskRand(30.0f);
+      light.position = glm::vec3(xy, glm::linearRand(-28.0f, 4.0f));
+      light.radius = glm::linearRand(3.0f, 8.0f);
+      light.color = glm::vec4(glm::linearRand(glm::vec3(0.1f), glm::vec3(1.0f)), 1.0f);
+      lightClusters.add(light);
+    }
+  }
+
+  void updatePointLights( ){
+    lightClusters[0].position = light0.position;
+    lightClusters[0].color = light0.color( );
+    lightClusters[1].position = light1.position;
+    lightClusters[1].color = light1.color( );
+  }
+
   bool begin( ){
     msglError( );
     initCenterPosition( );
+    initMaterials( );
+    initTextureFiles( );
+    // Decided first, so initSquares( ) asks only for the textures the
+    // chosen path draws with
+    useInstancing = InstanceBatch::supported( ) && TextureArray::supported( ) && !forcePerObject;
+    if(useInstancing && !textureArray.load(textureFiles, textureLoader)){
+      useInstancing = false;
+    }
     initBoundingBox();
     initSquares( );
+    initTeapots( );
+    initTransforms( );
     initCamera( );
     initRotationDelta( );
     initLights( );
     debugMaterialFlag = false;
 
-    // Load shader programs
-    const char* vertexShaderSource = "blinn_phong.vert.glsl";
-    const char* fragmentShaderSource = "blinn_phong.frag.glsl";
-    FragmentShader fragmentShader(fragmentShaderSource);
-    VertexShader vertexShader(vertexShaderSource);
-    shaderProgram.attach(vertexShader);
-    shaderProgram.attach(fragmentShader);
-    shaderProgram.link( );
-    shaderProgram.activate( );
-
-    /*
-    GLuint tex1ID;
-    int texture_width, texture_height, nrChannels;
-    glEnable(GL_TEXTURE_2D);
-    glGenTextures(1, &tex1ID);
-    glBindTexture(GL_TEXTURE_2D, tex1ID);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    unsigned char* data = stbi_load("textures/awesomeface.png", &texture_width, &texture_height, &nrChannels, 0);
-    if (data) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    } else {
-        std::cout << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
-    */
-    
-    printf("Shader program built from %s and %s.\n",
-           vertexShaderSource, fragmentShaderSource);
-    if( shaderProgram.isActive( ) ){
-      printf("Shader program is loaded and active with id %d.\n", shaderProgram.id( ) );
+    useClusters = pointLightCount > 0 && LightClusters::supported( );
+    if(pointLightCount > 0 && !useClusters){
+      fprintf(stderr, "Clustered lighting needs float textures; drawing without the extra lights.\n");
+    }
+    if(useClusters){
+      initPointLights( );
+      printf("%u point lights binned into %dx%dx%d clusters.\n", unsigned(lightClusters.size( )),
+             LightClusters::TILES_X, LightClusters::TILES_Y, LightClusters::SLICES);
+    }
+
+    // Choose the shader sources; core profile contexts need the GLSL
+    // 3.30 ones. The programs themselves are built on first use.
+    useProgramCache = ProgramCache::supported( );
+    programs.setProgramCache(useProgramCache ? &programCache : NULL);
+    bool core = isCoreProfile( );
+    printf("Using an OpenGL %s profile context.\n", core ? "3.3 core" : "compatibility");
+    if(core){
+      programs.setSources(false, "blinn_phong_330.vert.glsl", "blinn_phong_330.frag.glsl");
     }else{
-      printf("Shader program is not active, id: %d\n.", shaderProgram.id( ));
+      programs.setSources(false, "blinn_phong.vert.glsl", "blinn_phong.frag.glsl");
+    }
+
+    if(useInstancing){
+      useUniformBuffers = UniformBuffer::supported( );
+      if(core){
+        programs.setSources(true, "blinn_phong_ubo_330.vert.glsl", "blinn_phong_ubo_330.frag.glsl");
+      }else if(useUniformBuffers){
+        programs.setSources(true, "blinn_phong_ubo.vert.glsl", "blinn_phong_ubo.frag.glsl");
+      }else{
+        programs.setSources(true, "blinn_phong_instanced.vert.glsl", "blinn_phong_instanced.frag.glsl");
+      }
+      if(useUniformBuffers){
+        uploadMaterials( );
+      }
+    }
+    if(shaderWatcher.supported( )){
+      const char* sources[] = {"blinn_phong.vert.glsl", "blinn_phong.frag.glsl",
+                               "blinn_phong_330.vert.glsl", "blinn_phong_330.frag.glsl",
+                               "blinn_phong_instanced.vert.glsl", "blinn_phong_instanced.frag.glsl",
+                               "blinn_phong_ubo.vert.glsl", "blinn_phong_ubo.frag.glsl",
+                               "blinn_phong_ubo_330.vert.glsl", "blinn_phong_ubo_330.frag.glsl"};
+      for(size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++){
+        if(programs.uses(sources[i])){
+          shaderWatcher.watch(sources[i]);
+        }
+      }
+      printf("Shader sources are reloaded when they change.\n");
+    }
+    printf("Drawing %s.\n", useInstancing ? "instanced" : "one object at a time");
+    if(useInstancing){
+      printf("Instances are streamed through %s.\n", StreamBuffer::supportsPersistent( ) ? "a persistently mapped buffer" : "glBufferSubData");
+      printf("Per-frame and material uniforms %s.\n", useUniformBuffers ? "are in uniform buffers" : "are set one by one");
     }
-    
-    // Set up uniform variables for the shader program
-    uModelViewMatrix = glGetUniformLocation(shaderProgram.id( ), "modelViewMatrix");
-    uProjectionMatrix = glGetUniformLocation(shaderProgram.id( ), "projectionMatrix");
-    uNormalMatrix = glGetUniformLocation(shaderProgram.id( ), "normalMatrix");
-    uLight0_position = glGetUniformLocation(shaderProgram.id( ), "light0_position");
-    uLight0_color = glGetUniformLocation(shaderProgram.id( ), "light0_color");
-    uLight1_position = glGetUniformLocation(shaderProgram.id( ), "light1_position");
-    uLight1_color = glGetUniformLocation(shaderProgram.id( ), "light1_color");
-    uAmbient = glGetUniformLocation(shaderProgram.id( ), "ambient");
-    uDiffuse = glGetUniformLocation(shaderProgram.id( ), "diffuse");
-    uSpecular = glGetUniformLocation(shaderProgram.id( ), "specular");
-    uShininess = glGetUniformLocation(shaderProgram.id( ), "shininess");
-    uTexture = glGetUniformLocation(shaderProgram.id(), "texture");
 
     glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
     glEnable(GL_DEPTH_TEST);
+    if(benchmarkFrames > 0){
+      // Every timed frame simulates one step, however long it takes,
+      // and draws with every texture loaded
+      sync(ASYNC);
+      pacer( ).setLockstep(true);
+      textureLoader.finish( );
+    }else{
+      pacer( ).setMode(pacing, targetRate);
+    }
+    if(useInstancing && textureArray.loaded( )){
+      printf("%d images in a texture %s.\n", textureArray.size( ), textureArray.isAtlas( ) ? "atlas" : "array");
+    }else if(useInstancing){
+      printf("%d images loading into a texture array.\n", textureArray.size( ));
+    }
+    printf("Frame pacing: %s.\n", FramePacer::name(pacer( ).mode( )));
     glDepthFunc(GL_LESS);
 
+    if(!capturePath.empty( )){
+      std::tuple<int, int> w = windowSize( );
+      size_t n = capturePath.size( );
+      bool y4m = n > 4 && capturePath.compare(n - 4, 4, ".y4m") == 0;
+      if(capture.start(capturePath, y4m ? FrameCapture::Y4M : FrameCapture::PNG, std::get<0>(w), std::get<1>(w))){
+        printf("Recording frames to %s%s.\n", capturePath.c_str( ), y4m ? "" : "*.png");
+      }
+    }
+
     msglVersion( );
     
     return !msglError( );
   }
   
   bool end( ){
+    capture.stop( );
     windowShouldClose( );
     return true;
   }
 
-  void activateUniformsWithTexture(glm::vec4& _light0, glm::vec4& _light1, Material* m, Texture* t) {
-    activateUniforms(_light0, _light1, m);
+  // Starts rebuilding the programs of any shader file saved since the
+  // last frame and swaps in those that have finished.
+  void poll( ){
+    changedFiles.clear( );
+    shaderWatcher.poll(changedFiles);
+    for(size_t i = 0; i < changedFiles.size( ); i++){
+      programs.reload(changedFiles[i]);
+    }
+    reloadedPrograms.clear( );
+    if(programs.update(reloadedPrograms) > 0){
+      // The replaced programs were deleted and their names may be
+      // handed out again.
+      glState.invalidate( );
+      for(size_t i = 0; i < reloadedPrograms.size( ); i++){
+        setUpProgram(*programs.find(reloadedPrograms[i]));
+      }
+    }
+  }
+
+  // The palette does not change while running so it is uploaded once:
+  // into the material block, or into each instanced program as it is
+  // built, where uniform values persist.
+  void uploadMaterials(Program* program = NULL){
+    std::vector<glm::vec4> ambient, diffuse, specular;
+    for(int i = 0; i < materials.size( ); i++){
+      ambient.push_back(materials[i]->ambient);
+      diffuse.push_back(materials[i]->diffuse);
+      specular.push_back(glm::vec4(glm::vec3(materials[i]->specular), materials[i]->shininess));
+    }
+    if(!program){
+      MaterialUniforms block;
+      for(int i = 0; i < MaterialLibrary::MAX_MATERIALS; i++){
+        bool used = i < materials.size( );
+        block.ambient[i] = used ? ambient[i] : glm::vec4(0.0);
+        block.diffuse[i] = used ? diffuse[i] : glm::vec4(0.0);
+        block.specular[i] = used ? specular[i] : glm::vec4(0.0);
+      }
+      materialUniforms.upload(&block, sizeof(block));
+      return;
+    }
+    glState.useProgram(program->id( ));
+    glUniform4fv(program->uniforms.materialAmbient, materials.size( ), glm::value_ptr(ambient[0]));
+    glUniform4fv(program->uniforms.materialDiffuse, materials.size( ), glm::value_ptr(diffuse[0]));
+    glUniform4fv(program->uniforms.materialSpecular, materials.size( ), glm::value_ptr(specular[0]));
+  }
+
+  // The wall image is plain white; multiplying by it changes nothing,
+  // so walls and teapots use variants without the texture lookup.
+  bool isTextured(int textureID) const{
+    return textureID != wallTexture;
+  }
+
+  // With clusters every light, the spinning ones included, comes from
+  // the cluster lists.
+  ShaderKey shaderKey(bool textured, bool instanced) const{
+    if(useClusters){
+      return ShaderKey(0, textured, instanced, true);
+    }
+    return ShaderKey(lightCount, textured, instanced);
+  }
+
+  // The program for key, built and set up if this is its first use
+  Program& program(const ShaderKey& key){
+    bool built;
+    Program& p = programs.get(key, &built);
+    if(built){
+      setUpProgram(p);
+      if(useProgramCache){
+        printf("Program binary cache: %u hits, %u misses.\n", programCache.hits( ), programCache.misses( ));
+      }
+    }
+    return p;
+  }
+
+  // State a program keeps for its lifetime, set once it has linked
+  void setUpProgram(Program& p){
+    if(!p.key.instanced){
+      return;
+    }
+    if(useUniformBuffers){
+      UniformBuffer::bindBlock(p.id( ), "FrameBlock", FRAME_BLOCK);
+      UniformBuffer::bindBlock(p.id( ), "MaterialBlock", MATERIAL_BLOCK);
+    }else{
+      uploadMaterials(&p);
+    }
+  }
+
+  void activateUniformsWithTexture(const ProgramUniforms& u, glm::vec4& _light0, glm::vec4& _light1, Material* m, Texture* t) {
+    activateUniforms(u, _light0, _light1, m);
     t->bind();
-    glUniform1i(uTexture, 0);
+    glState.uniform1i(u.texture, 0);
 
   }
   
-  void activateUniforms(glm::vec4& _light0, glm::vec4& _light1, Material* m){
-    glUniformMatrix4fv(uModelViewMatrix, 1, false, glm::value_ptr(modelViewMatrix));
-    glUniformMatrix4fv(uProjectionMatrix, 1, false, glm::value_ptr(projectionMatrix));
-    glUniformMatrix4fv(uNormalMatrix, 1, false, glm::value_ptr(normalMatrix));
+  void activateUniforms(const ProgramUniforms& u, glm::vec4& _light0, glm::vec4& _light1, Material* m){
+    glState.uniformMatrix4fv(u.modelViewMatrix, 1, glm::value_ptr(modelViewMatrix));
+    glState.uniformMatrix4fv(u.projectionMatrix, 1, glm::value_ptr(projectionMatrix));
+    glState.uniformMatrix4fv(u.normalMatrix, 1, glm::value_ptr(normalMatrix));
 
-    glUniform4fv(uLight0_position, 1, glm::value_ptr(_light0));
-    glUniform4fv(uLight0_color, 1, glm::value_ptr(light0.color( )));
+    glState.uniform4fv(u.light0_position, 1, glm::value_ptr(_light0));
+    glState.uniform4fv(u.light0_color, 1, glm::value_ptr(light0.color( )));
     
-    glUniform4fv(uLight1_position, 1, glm::value_ptr(_light1));
-    glUniform4fv(uLight1_color, 1, glm::value_ptr(light1.color( )));
+    glState.uniform4fv(u.light1_position, 1, glm::value_ptr(_light1));
+    glState.uniform4fv(u.light1_color, 1, glm::value_ptr(light1.color( )));
 
-    glUniform4fv(uAmbient, 1, glm::value_ptr(m->ambient));
-    glUniform4fv(uDiffuse, 1, glm::value_ptr(m->diffuse));
-    glUniform4fv(uSpecular, 1, glm::value_ptr(m->specular));
-    glUniform1f(uShininess, m->shininess);
+    glState.uniform4fv(u.ambient, 1, glm::value_ptr(m->ambient));
+    glState.uniform4fv(u.diffuse, 1, glm::value_ptr(m->diffuse));
+    glState.uniform4fv(u.specular, 1, glm::value_ptr(m->specular));
+    glState.uniform1f(u.shininess, m->shininess);
+    activateClusterUniforms(u);
   }
 
-  bool render( ){
-    glm::vec4 _light0;
-    glm::vec4 _light1;
-    glm::mat4 lookAtMatrix;
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    std::tuple<int, int> w = windowSize( );
-    double ratio = double(std::get<0>(w)) / double(std::get<1>(w));
+  void activateClusterUniforms(const ProgramUniforms& u){
+    if(!useClusters){
+      return;
+    }
+    glState.uniform1i(u.clusterLights, LightClusters::LIGHT_UNIT);
+    glState.uniform1i(u.clusterGrid, LightClusters::GRID_UNIT);
+    glState.uniform1i(u.clusterIndices, LightClusters::INDEX_UNIT);
+    glState.uniform4fv(u.clusterScale, 1, glm::value_ptr(lightClusters.scale( )));
+    glState.uniform4fv(u.clusterSize, 1, glm::value_ptr(lightClusters.dimensions( )));
+    glState.uniform4fv(u.clusterRows, 1, glm::value_ptr(lightClusters.rows( )));
+  }
 
+  // Bounces a pair of colliding squares off each other.
+  void bounce(Square* a, Square* b){
+    //find direction of collision
+    glm::vec3 ba = a->position - b->position;
+    float dot = glm::dot(ba, b->up);
+    float angle = acos(dot);
+    float direction = glm::dot(glm::cross(ba, b->up), b->up); // coming from right or left
+    glm::vec3 surfaceNormal;
+    if(direction < 0) {// coming from the left
+      angle = -angle;
+    }
 
-    mainCamera.perspectiveMatrix(projectionMatrix, ratio);
+    if(fabs(angle) < 45.0) { // approaching from above
+      surfaceNormal = glm::vec3(0.0, 1.0, 0.0);
+    } else if(fabs(angle) > 135.0f) {  // approaching from below
+      surfaceNormal = glm::vec3(0.0, -1.0, 0.0);
+    } else if(angle < 0) {  // approaching from the left
+      surfaceNormal = glm::vec3(-1.0, 0.0, 0.0);
+    } else{ // approaching from the right, probably
+      surfaceNormal = glm::vec3(1.0, 0.0, 0.0);
+    }
 
-    mainCamera.lookAtMatrix(lookAtMatrix);
+    a->velocity = glm::reflect(a->velocity, surfaceNormal);
+    b->velocity = glm::reflect(b->velocity, -surfaceNormal);
+  }
 
-    // Set light & material properties for the teapot;
-    // lights are transformed by current modelview matrix
-    // such that they are positioned correctly in the scene.
-    _light0 = lookAtMatrix * light0.position4( );
-    _light1 = lookAtMatrix * light1.position4( );
+  // Squares are unit quads in their xy plane.
+  void boundSquares( ){
+    squareBounds.clear( );
+    for(int i = 0; i < squareCount; i++){
+      squareBounds.add(squares[i]->position, glm::vec3(0.5f * squares[i]->scale.x, 0.5f * squares[i]->scale.y, 0.0f));
+    }
+  }
 
-    for(int i = 0; i < 4; i++) {
-      modelViewMatrix = glm::translate(lookAtMatrix, boundingBox[i]->position);
-      modelViewMatrix = glm::scale(modelViewMatrix, boundingBox[i]->scale*glm::vec3(1.0));
-      normalMatrix = glm::inverseTranspose(modelViewMatrix);
-      shaderProgram.activate( );
-      activateUniformsWithTexture(_light0, _light1, boundingBox[i]->material, texwhitesquare);
-      boundingBox[i]->draw();
-      texwhitesquare->unbind();
+  struct SquarePairs{
+    CollisionDetectionApp* app;
+    void operator ()(uint32_t i, uint32_t j) const{
+      Square* a = app->squares[i];
+      Square* b = app->squares[j];
+      if(a->visible && b->visible && a->isColliding(*b)){
+        app->bounce(a, b);
+      }
     }
-    
+  };
+
+  // Only squares whose bounding boxes overlap are tested against each
+  // other, and every such pair bounces once. The quadtree is rebuilt
+  // for this frame's positions and refit after the squares move so
+  // buildDrawList( ) culls with it.
+  void simulate( ){
     for(int i = 0; i < squareCount; i++){
       if(squares[i]->visible){
+        // Push squares back to just inside the wall they hit
+        float inside = 7.5 - 0.5 * squares[i]->scale.x;
         for(int j = 0; j < 4; j++) {
           if(squares[i]->isColliding(*boundingBox[j])) {
             //printf("Square# %i collided with wall# %i\n", i, j);
@@ -321,19 +778,19 @@ public:
             switch(j) {
               case 0: //left wall
                 surfaceNormal = glm::vec3(1.0, 0.0, 0.0);
-                squares[i]->position = glm::vec3(-7.0, squares[i]->position.y, 0.0);
+                squares[i]->position = glm::vec3(-inside, squares[i]->position.y, 0.0);
                 break;
               case 1: //top wall
                 surfaceNormal = glm::vec3(0.0, -1.0, 0.0);
-                squares[i]->position = glm::vec3(squares[i]->position.x, 7.0, 0.0);
+                squares[i]->position = glm::vec3(squares[i]->position.x, inside, 0.0);
                 break;
               case 2: //right wall
                 surfaceNormal = glm::vec3(-1.0, 0.0, 0.0);
-                squares[i]->position = glm::vec3(7.0, squares[i]->position.y, 0.0);
+                squares[i]->position = glm::vec3(inside, squares[i]->position.y, 0.0);
                 break;
               case 3: //bottom wall
                 surfaceNormal = glm::vec3(0.0, 1.0, 0.0);
-                squares[i]->position = glm::vec3(squares[i]->position.x, -7.0, 0.0);
+                squares[i]->position = glm::vec3(squares[i]->position.x, -inside, 0.0);
                 break;
               default:
                 break;
@@ -341,59 +798,302 @@ public:
             squares[i]->velocity = glm::reflect(squares[i]->velocity, surfaceNormal);
           }
         }
+      }
+    }
 
-        for(int j = 0; j < squareCount; j++) {
-          if(i != j) {
-            if(squares[i]->isColliding(*squares[j])) {
-              //find direction of collision
-              glm::vec3 ji = squares[i]->position - squares[j]->position;
-              float dot = glm::dot(ji, squares[j]->up);
-              float angle = acos(dot);
-              float direction = glm::dot(glm::cross(ji, squares[j]->up), squares[j]->up); // coming from right or left
-              glm::vec3 surfaceNormal;
-              if(direction < 0) {// coming from the left
-                angle = -angle;
-              }
-
-              if(fabs(angle) < 45.0) { // approaching from above
-                surfaceNormal = glm::vec3(0.0, 1.0, 0.0);
-              } else if(fabs(angle) > 135.0f) {  // approaching from below
-                surfaceNormal = glm::vec3(0.0, -1.0, 0.0);
-              } else if(angle < 0) {  // approaching from the left
-                surfaceNormal = glm::vec3(-1.0, 0.0, 0.0);
-              } else{ // approaching from the right, probably
-                surfaceNormal = glm::vec3(1.0, 0.0, 0.0);
-              }
-              
-              squares[i]->velocity = glm::reflect(squares[i]->velocity, surfaceNormal);
-              squares[j]->velocity = glm::reflect(squares[j]->velocity, -surfaceNormal);
-            }
-          }
-        }
+    boundSquares( );
+    broadphase.build(squareBounds);
+    SquarePairs pairs = {this};
+    broadphase.forEachOverlappingPair(squareBounds, pairs);
+
+    for(int i = 0; i < squareCount; i++){
+      if(squares[i]->visible){
+        squares[i]->update( );
+      }
+    }
+    boundSquares( );
+    broadphase.refit(squareBounds);
+  }
+
+  Square* drawable(uint32_t payload){
+    return payload < 4 ? boundingBox[payload] : squares[payload - 4];
+  }
+
+  uint32_t teapotPayload(uint32_t teapot) const{
+    return 4 + uint32_t(squares.size( )) + teapot;
+  }
 
-        modelViewMatrix = glm::translate(lookAtMatrix, squares[i]->position);
-        modelViewMatrix = glm::scale(modelViewMatrix, squares[i]->scale*glm::vec3(1.0));
-        normalMatrix = glm::inverseTranspose(modelViewMatrix);
-        shaderProgram.activate( );
-        activateUniformsWithTexture(_light0, _light1, squares[i]->material, texhappyface);
-        squares[i]->draw( );
-        texhappyface->unbind();
-        //printf("square #: %i, visible: %i, position: %.2f, %.2f, %.2f\n", i, squares[i]->visible, squares[i]->position.x, squares[i]->position.y, squares[i]->position.z);
+  bool isTeapot(uint32_t payload) const{
+    return payload >= 4 + squares.size( );
+  }
+
+  const TeapotInstance& teapot(uint32_t payload){
+    return teapots[payload - 4 - squares.size( )];
+  }
+
+  // Keys every visible wall and square inside the view frustum and
+  // every teapot that survived teapots.update( ), and sorts them. The
+  // instanced path reads material and image per instance, so only the
+  // per-object path groups draws by them.
+  void buildDrawList(glm::mat4& lookAtMatrix, const Frustum& frustum){
+    drawList.clear( );
+    for(uint32_t i = 0; i < 4; i++){
+      Square* obj = drawable(i);
+      if(obj->visible && frustum.intersects(obj->position, glm::vec3(0.5f * obj->scale.x, 0.5f * obj->scale.y, 0.0f))){
+        addDraw(lookAtMatrix, i);
       }
     }
+    visibleSquares.clear( );
+    broadphase.cull(frustum, visibleSquares);
+    for(size_t i = 0; i < visibleSquares.size( ); i++){
+      if(squares[visibleSquares[i]]->visible){
+        addDraw(lookAtMatrix, 4 + visibleSquares[i]);
+      }
+    }
+    // Teapots are plain white under their material
+    unsigned int teapotProgram = shaderKey(false, useInstancing).index( );
+    for(size_t i = 0; i < teapots.visibleCount( ); i++){
+      uint32_t payload = teapotPayload(teapots.visible(i));
+      const TeapotInstance& t = teapot(payload);
+      unsigned int material = useInstancing ? 0 : t.materialID;
+      drawList.add(DrawList::makeKey(DrawList::LAYER_OPAQUE, teapotProgram, 0, MESH_TEAPOT + t.lod, material,
+                                     t.depth, mainCamera.near, mainCamera.far), payload);
+    }
+    drawList.sort( );
+  }
+
+  Mesh& mesh(uint64_t key){
+    unsigned int m = DrawList::mesh(key);
+    return m == MESH_QUAD ? Square::quad( ) : UtahTeapot::lodMesh(m - MESH_TEAPOT);
+  }
+
+  void addDraw(glm::mat4& lookAtMatrix, uint32_t payload){
+    Square* obj = drawable(payload);
+    unsigned int program = shaderKey(isTextured(obj->textureID), useInstancing).index( );
+    float depth = -(lookAtMatrix * glm::vec4(obj->position, 1.0)).z;
+    unsigned int texture = useInstancing ? 0 : obj->textureID;
+    unsigned int material = useInstancing ? 0 : obj->materialID;
+    drawList.add(DrawList::makeKey(DrawList::LAYER_OPAQUE, program, texture, MESH_QUAD, material,
+                                   depth, mainCamera.near, mainCamera.far), payload);
+  }
+
+  // Binds, program changes and uniform uploads go through glState so
+  // consecutive objects that share a program, texture, mesh or
+  // material do not repeat them.
+  void renderPerObject(glm::mat4& lookAtMatrix, glm::vec4& _light0, glm::vec4& _light1){
+    for(size_t i = 0; i < squares.size( ); i++){
+      transforms.setLocal(drawableNode(4 + i), TransformHierarchy::translateScale(squares[i]->position, squares[i]->scale));
+    }
+    transforms.update(lookAtMatrix);
+    for(size_t i = 0; i < drawList.size( ); i++){
+      uint32_t payload = drawList[i].payload;
+      modelViewMatrix = transforms.modelView(drawableNode(payload));
+      normalMatrix = transforms.normal(drawableNode(payload));
+      Program& p = program(ShaderKey::fromIndex(DrawList::program(drawList[i].key)));
+      glState.useProgram(p.id( ));
+      if(isTeapot(payload)){
+        activateUniforms(p.uniforms, _light0, _light1, materials[teapot(payload).materialID]);
+        mesh(drawList[i].key).draw( );
+        continue;
+      }
+      Square* obj = drawable(payload);
+      if(p.key.textured){
+        activateUniformsWithTexture(p.uniforms, _light0, _light1, obj->material, textures[obj->textureID].get( ));
+      }else{
+        activateUniforms(p.uniforms, _light0, _light1, obj->material);
+      }
+      obj->draw( );
+    }
+  }
+
+  void writeInstance(InstanceData& instance, uint32_t payload){
+    if(isTeapot(payload)){
+      const TeapotInstance& t = teapot(payload);
+      instance.position = t.position;
+      instance.scale = glm::vec3(t.scale);
+      instance.materialID = float(t.materialID);
+      instance.textureLayer = textureArray.layer(wallTexture);
+      instance.textureRect = textureArray.rect(wallTexture);
+      return;
+    }
+    Square* square = drawable(payload);
+    instance.position = square->position;
+    instance.scale = square->scale;
+    instance.materialID = float(square->materialID);
+    instance.textureLayer = textureArray.layer(square->textureID);
+    instance.textureRect = textureArray.rect(square->textureID);
+  }
+
+  // Makes an instanced program current with this frame's values;
+  // with uniform buffers those are shared and written once per frame.
+  void useInstanced(Program& p, glm::mat4& lookAtMatrix, glm::vec4& _light0, glm::vec4& _light1){
+    glState.useProgram(p.id( ));
+    if(!useUniformBuffers){
+      glState.uniformMatrix4fv(p.uniforms.viewMatrix, 1, glm::value_ptr(lookAtMatrix));
+      glState.uniformMatrix4fv(p.uniforms.projectionMatrix, 1, glm::value_ptr(projectionMatrix));
+      glState.uniform4fv(p.uniforms.light0_position, 1, glm::value_ptr(_light0));
+      glState.uniform4fv(p.uniforms.light0_color, 1, glm::value_ptr(light0.color( )));
+      glState.uniform4fv(p.uniforms.light1_position, 1, glm::value_ptr(_light1));
+      glState.uniform4fv(p.uniforms.light1_color, 1, glm::value_ptr(light1.color( )));
+    }
+    glState.uniform1i(p.uniforms.texture, 0);
+    activateClusterUniforms(p.uniforms);
+  }
+
+  void renderInstanced(glm::mat4& lookAtMatrix, glm::vec4& _light0, glm::vec4& _light1){
+    if(useUniformBuffers){
+      FrameUniforms* frame = (FrameUniforms*)frameUniforms.map(sizeof(FrameUniforms));
+      frame->viewMatrix = lookAtMatrix;
+      frame->projectionMatrix = projectionMatrix;
+      frame->light0_position = _light0;
+      frame->light0_color = light0.color( );
+      frame->light1_position = _light1;
+      frame->light1_color = light1.color( );
+      frameUniforms.unmap( );
+    }
+
+    // Instances are written straight into the batch's stream buffer in
+    // draw list order, front to back.
+    size_t n = drawList.size( );
+    InstanceData* instances = batch.map(n);
+    for(size_t i = 0; i < n; i++){
+      writeInstance(instances[i], drawList[i].payload);
+    }
+    batch.unmap(n);
+    textureArray.bind( );
+    // Each run of draws that share layer, program, texture and mesh is
+    // one instanced draw; with every image in the texture array the
+    // walls are one run, the squares another and the teapots one per
+    // level of detail.
+    size_t first = 0;
+    for(size_t i = 1; i <= n; i++){
+      if(i == n || !DrawList::sameBatch(drawList[first].key, drawList[i].key)){
+        useInstanced(program(ShaderKey::fromIndex(DrawList::program(drawList[first].key))), lookAtMatrix, _light0, _light1);
+        batch.draw(mesh(drawList[first].key), first, i - first);
+        first = i;
+      }
+    }
+    batch.fence( );
+    frameUniforms.fence( );
+  }
+
+  bool render( ){
+    glm::vec4 _light0;
+    glm::vec4 _light1;
+    glm::mat4 lookAtMatrix;
+
+    glState.beginFrame( );
+    // Images decoded since the last frame replace their placeholders
+    textureLoader.update( );
+    if(printStats && frameCount > 0 && frameCount % statsInterval == 0){
+      glState.report(stderr);
+      if(useClusters){
+        fprintf(stderr, "Clustered lights: %u lights, %u list entries, %u dropped from full clusters\n",
+                unsigned(lightClusters.size( )), unsigned(lightClusters.references( )), unsigned(lightClusters.dropped( )));
+      }
+      if(!useInstancing){
+        fprintf(stderr, "Normal matrices recomputed:");
+        for(int k = 0; k < NormalMatrices::KIND_COUNT; k++){
+          NormalMatrices::Kind kind = NormalMatrices::Kind(k);
+          fprintf(stderr, " %u %s%s", transforms.normalMatrices( ).count(kind) / statsInterval, NormalMatrices::name(kind), k + 1 < NormalMatrices::KIND_COUNT ? "," : "");
+        }
+        fprintf(stderr, " per frame\n");
+      }
+      transforms.normalMatrices( ).resetCounts( );
+      fprintf(stderr, "Texture cache: %u hits, %u misses, %u textures live, %u still loading\n",
+              textureCache.hits( ), textureCache.misses( ), unsigned(textureCache.live( )), textureLoader.pending( ));
+      pacer( ).report(stderr);
+    }
+    frameCount++;
+    if(benchmarkFrames > 0 && frameCount == 2){
+      // The first frame bakes meshes and allocates buffers
+      glFinish( );
+      benchmarkStart = seconds( );
+      pacer( ).reset( );
+    }
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    std::tuple<int, int> w = windowSize( );
+    double ratio = double(std::get<0>(w)) / double(std::get<1>(w));
+
+
+    mainCamera.perspectiveMatrix(projectionMatrix, ratio);
+
+    mainCamera.lookAtMatrix(lookAtMatrix);
+
+    // Set light & material properties for the teapot;
+    // lights are transformed by current modelview matrix
+    // such that they are positioned correctly in the scene.
+    _light0 = lookAtMatrix * light0.position4( );
+    _light1 = lookAtMatrix * light1.position4( );
+    if(useClusters){
+      updatePointLights( );
+      lightClusters.update(lookAtMatrix, projectionMatrix, mainCamera.near, mainCamera.far, std::get<0>(w), std::get<1>(w));
+      lightClusters.bind( );
+    }
+
+    // Simulation runs at a fixed rate however fast frames are drawn
+    for(unsigned int step = 0; step < pacer( ).substeps( ); step++){
+      simulate( );
+    }
+
+    // Only what is inside the view frustum reaches the draw list
+    Frustum frustum;
+    mainCamera.frustum(frustum, ratio);
+    teapots.update(mainCamera, frustum, lookAtMatrix, std::get<1>(w));
+    buildDrawList(lookAtMatrix, frustum);
+    if(useInstancing){
+      renderInstanced(lookAtMatrix, _light0, _light1);
+    }else{
+      renderPerObject(lookAtMatrix, _light0, _light1);
+    }
 
     if(isKeyPressed('R')){
       /*initEyePosition( );
       initUpVector( );*/
       initCamera( );
       initSquares();
+      initTransforms( );
       initRotationDelta( );
       initLights( );  
       printf("Eye position, up vector and rotation delta reset.\n");
     }
 
+    if(isKeyPressed('P')){
+      keyUp('P');
+      if(!capture.active( )){
+        char name[32];
+        snprintf(name, sizeof(name), "screenshot-%u", frameCount);
+        std::tuple<int, int> w = windowSize( );
+        if(capture.start(name, FrameCapture::PNG, std::get<0>(w), std::get<1>(w), 1)){
+          printf("Saving %s.png.\n", name);
+        }
+      }
+    }
+    capture.capture( );
+
+    if(benchmarkFrames > 0 && frameCount == benchmarkFrames + 1){
+      reportBenchmark( );
+      windowShouldClose( );
+    }
+
     return !msglError( );
   }
+
+  void reportBenchmark( ){
+    glFinish( );
+    double elapsed = seconds( ) - benchmarkStart;
+    printf("%u teapots, %u squares, %s: %.3f ms per frame over %u frames\n",
+           teapotCount, squareCount, useInstancing ? "instanced" : "one object at a time",
+           1000.0 * elapsed / benchmarkFrames, benchmarkFrames);
+    printf("%zu of %u teapots in view; per level of detail:", teapots.visibleCount( ), teapotCount);
+    for(int level = 0; level < UtahTeapot::LOD_COUNT; level++){
+      printf(" grid %d: %zu", UtahTeapot::lodGrid(level), teapots.bucketSize(level));
+    }
+    printf("; %zu triangles\n", teapots.triangles( ));
+    pacer( ).report(stdout);
+  }
     
 };
 
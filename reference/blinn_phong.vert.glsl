@@ -0,0 +1,54 @@
+# version 120 
+//
+// The per-fragment form of the shader in the directory above, as it
+// was before eye space moved into the vertex stage. shader_check.cpp
+// renders both and checks they agree; do not edit.
+//
+/*
+ * Michael Shafae
+ * mshafae at fullerton.edu
+ * 
+ * A simple Phong shader with two light sources.
+ *
+ * Be aware that for this course, we are limiting ourselves to
+ * GLSL v.1.2. This is not at all the contemporary shading
+ * programming environment, but it offers the greatest degree
+ * of compatability.
+ *
+ * Please do not use syntax from GLSL > 1.2 for any homework
+ * submission.
+ *
+ */
+
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
+// These are passed in from the CPU program
+uniform mat4 modelViewMatrix;
+uniform mat4 projectionMatrix;
+
+// Generic vertex attributes from the mesh's vertex buffer; the
+// locations are bound by the CPU program before linking.
+attribute vec4 vertexPosition;
+attribute vec3 vertexNormal;
+attribute vec2 vertexTexCoord;
+
+// These are variables that we wish to send to our fragment shader
+// In later versions of GLSL, these are 'out' variables.
+varying vec3 myNormal;
+varying vec4 myVertex;
+#if TEXTURED
+varying vec2 myTexCoord;
+#endif
+
+void main() {
+  gl_Position = projectionMatrix * modelViewMatrix * vertexPosition;
+  myNormal = vertexNormal;
+  myVertex = vertexPosition;
+#if TEXTURED
+  myTexCoord = vertexTexCoord;
+#endif
+}
@@ -0,0 +1,101 @@
+#version 330 core
+//
+// The per-fragment form of the shader in the directory above, as it
+// was before eye space moved into the vertex stage. shader_check.cpp
+// renders both and checks they agree; do not edit.
+//
+/*
+ * blinn_phong.frag.glsl for OpenGL 3.3 core profile contexts; see
+ * blinn_phong_330.vert.glsl.
+ *
+ */
+
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 2
+#endif
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
+in vec3 myNormal;
+in vec4 myVertex;
+#if TEXTURED
+in vec2 myTexCoord;
+#endif
+
+// These are passed in from the CPU program
+uniform mat4 modelViewMatrix;
+uniform mat4 projectionMatrix;
+uniform mat4 normalMatrix;
+// Information about the lights
+uniform vec4 light0_position;
+uniform vec4 light0_color;
+uniform vec4 light1_position;
+uniform vec4 light1_color;
+// Material properties
+uniform vec4 ambient;
+uniform vec4 diffuse;
+uniform vec4 specular;
+uniform float shininess;
+#if TEXTURED
+// Texture; in GLSL 3.30 texture is the name of the lookup function
+uniform sampler2D textureImage;
+#endif
+
+layout(location = 0) out vec4 fragColor;
+
+vec4 computeLight(const in vec3 direction, const in vec4 lightcolor, const in vec3 normal, const in vec3 reflection){
+
+  float nDotL = dot(normal, direction);
+  vec4 lambert = diffuse * lightcolor * max(nDotL, 0.0);
+
+  float nDotR = dot(normal, reflection);
+  vec4 phong = specular * lightcolor * pow(max(nDotR, 0.0), shininess);
+
+  vec4 retval = lambert + phong;
+  return retval;
+}       
+
+void main (void){
+
+  // They eye is always at (0,0,0) looking down -z axis 
+  // Also compute current fragment position and direction to eye 
+
+  const vec3 eyepos = vec3(0,0,0);
+  vec4 _mypos = modelViewMatrix * myVertex;
+  vec3 mypos = _mypos.xyz / _mypos.w;
+  vec3 eyedirn = normalize(eyepos - mypos);
+
+  // Compute normal, needed for shading. 
+  vec4 _normal = normalMatrix * vec4(myNormal, 0.0);
+  vec3 normal = normalize(_normal.xyz);
+
+  vec4 finalColor = ambient;
+
+#if LIGHT_COUNT > 0
+  // Light 0, point
+  vec3 position0 = light0_position.xyz / light0_position.w;
+  vec3 direction0 = normalize(position0 - mypos);
+  vec3 half0 = normalize(direction0 + eyedirn);
+
+  finalColor += computeLight(direction0, light0_color, normal, half0);
+#endif
+
+#if LIGHT_COUNT > 1
+  // Light 1, point
+  vec3 position1 = light1_position.xyz / light1_position.w;
+  vec3 direction1 = normalize(position1 - mypos);
+  vec3 half1 = normalize(direction1 + eyedirn); 
+
+  finalColor += computeLight(direction1, light1_color, normal, half1);
+  
+#endif
+
+#if TEXTURED
+  fragColor = texture(textureImage, myTexCoord) * finalColor;
+#else
+  fragColor = finalColor;
+#endif
+}
@@ -0,0 +1,40 @@
+#version 330 core
+//
+// The per-fragment form of the shader in the directory above, as it
+// was before eye space moved into the vertex stage. shader_check.cpp
+// renders both and checks they agree; do not edit.
+//
+/*
+ * blinn_phong.vert.glsl for OpenGL 3.3 core profile contexts, which
+ * do not accept GLSL 1.20. The attribute locations are fixed in the
+ * shader and match VertexAttribute in Mesh.h.
+ *
+ */
+
+// Features chosen by ShaderVariant.h; the defaults build the full
+// shader.
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
+uniform mat4 modelViewMatrix;
+uniform mat4 projectionMatrix;
+
+layout(location = 0) in vec4 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec2 vertexTexCoord;
+
+out vec3 myNormal;
+out vec4 myVertex;
+#if TEXTURED
+out vec2 myTexCoord;
+#endif
+
+void main() {
+  gl_Position = projectionMatrix * modelViewMatrix * vertexPosition;
+  myNormal = vertexNormal;
+  myVertex = vertexPosition;
+#if TEXTURED
+  myTexCoord = vertexTexCoord;
+#endif
+}
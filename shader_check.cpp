@@ -0,0 +1,189 @@
+//
+// Shader equivalence check
+//
+// Renders lit teapots through the per-object Blinn-Phong shaders and
+// through the per-fragment originals kept in reference/, and fails if
+// any channel of any pixel differs by more than 1/255. Every variant
+// without clustered lights is checked, for the GLSL 1.20 shaders and,
+// where the context has 3.3, the GLSL 3.30 ones.
+//
+// The teapots are scaled unevenly so their normals reach the shaders
+// at other than unit length. `make check-shaders` builds it with
+// HEADLESS, drawing offscreen through EGL.
+//
+//
+
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#ifdef HEADLESS
+#include "EGLApp.h"
+typedef EGLApp App;
+#else
+#include "GLFWApp.h"
+typedef GLFWApp App;
+#endif
+#include "GLSLShader.h"
+#include "ShaderVariant.h"
+#include "UtahTeapot.h"
+#include "Texture.h"
+
+class ShaderCheckApp : public App{
+private:
+  static const int SIZE = 256;
+  // Channels may differ by this much out of 255
+  static const int TOLERANCE = 1;
+  // The reference image must light at least this many pixels, so two
+  // shaders that both draw nothing do not pass
+  static const size_t MIN_LIT = SIZE * SIZE / 100;
+
+  struct Uniforms{
+    GLint modelViewMatrix;
+    GLint projectionMatrix;
+    GLint normalMatrix;
+    GLint light0_position;
+    GLint light0_color;
+    GLint light1_position;
+    GLint light1_color;
+    GLint ambient;
+    GLint diffuse;
+    GLint specular;
+    GLint shininess;
+    GLint texture;
+
+    void locate(GLuint program, const ShaderKey&){
+      modelViewMatrix = glGetUniformLocation(program, "modelViewMatrix");
+      projectionMatrix = glGetUniformLocation(program, "projectionMatrix");
+      normalMatrix = glGetUniformLocation(program, "normalMatrix");
+      light0_position = glGetUniformLocation(program, "light0_position");
+      light0_color = glGetUniformLocation(program, "light0_color");
+      light1_position = glGetUniformLocation(program, "light1_position");
+      light1_color = glGetUniformLocation(program, "light1_color");
+      ambient = glGetUniformLocation(program, "ambient");
+      diffuse = glGetUniformLocation(program, "diffuse");
+      specular = glGetUniformLocation(program, "specular");
+      shininess = glGetUniformLocation(program, "shininess");
+      texture = glGetUniformLocation(program, "textureImage");
+    }
+  };
+
+  Texture* texture;
+  bool passed;
+
+  // Draws three teapots with every variant of key's shape from the
+  // vertex and fragment files and reads the image back.
+  void draw(const std::string& vertexFile, const std::string& fragmentFile, const ShaderKey& key, std::vector<unsigned char>& pixels){
+    ShaderVariants<Uniforms> programs;
+    programs.setSources(false, vertexFile, fragmentFile);
+    ShaderVariant<Uniforms>& p = programs.get(key);
+    const Uniforms& u = p.uniforms;
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    GLStateCache::current( ).useProgram(p.id( ));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.5f, 20.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0, 2.0, 8.0), glm::vec3(0.0), glm::vec3(0.0, 1.0, 0.0));
+    glm::vec4 light0 = view * glm::vec4(3.0, 4.0, 4.0, 1.0);
+    glm::vec4 light1 = view * glm::vec4(-4.0, 1.0, -2.0, 1.0);
+    glUniformMatrix4fv(u.projectionMatrix, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform4fv(u.light0_position, 1, glm::value_ptr(light0));
+    glUniform4fv(u.light0_color, 1, glm::value_ptr(glm::vec4(1.0, 0.9, 0.8, 1.0)));
+    glUniform4fv(u.light1_position, 1, glm::value_ptr(light1));
+    glUniform4fv(u.light1_color, 1, glm::value_ptr(glm::vec4(0.3, 0.4, 0.6, 1.0)));
+    glUniform4fv(u.ambient, 1, glm::value_ptr(glm::vec4(0.1, 0.1, 0.1, 1.0)));
+    glUniform4fv(u.diffuse, 1, glm::value_ptr(glm::vec4(0.8, 0.5, 0.3, 1.0)));
+    glUniform4fv(u.specular, 1, glm::value_ptr(glm::vec4(1.0, 1.0, 1.0, 1.0)));
+    glUniform1f(u.shininess, 40.0);
+    texture->bind( );
+    glUniform1i(u.texture, 0);
+
+    const glm::vec3 positions[3] = {glm::vec3(-2.2, 0.0, 0.0), glm::vec3(0.0, 0.5, -1.0), glm::vec3(2.2, -0.5, 0.5)};
+    const glm::vec3 scales[3] = {glm::vec3(1.4, 0.6, 1.0), glm::vec3(0.7, 1.3, 0.9), glm::vec3(1.0, 1.0, 2.0)};
+    for(int i = 0; i < 3; i++){
+      glm::mat4 model = glm::translate(glm::mat4(1.0f), positions[i]);
+      model = glm::rotate(model, 0.7f * (i + 1), glm::vec3(0.3, 1.0, 0.2));
+      model = glm::scale(model, scales[i]);
+      glm::mat4 modelView = view * model;
+      glm::mat4 normal = glm::transpose(glm::inverse(modelView));
+      glUniformMatrix4fv(u.modelViewMatrix, 1, GL_FALSE, glm::value_ptr(modelView));
+      glUniformMatrix4fv(u.normalMatrix, 1, GL_FALSE, glm::value_ptr(normal));
+      UtahTeapot::mesh(14).draw( );
+    }
+    glFinish( );
+    pixels.resize(SIZE * SIZE * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, SIZE, SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    GLStateCache::current( ).useProgram(0);
+  }
+
+  void compare(const std::string& vertexFile, const std::string& fragmentFile, const ShaderKey& key){
+    std::vector<unsigned char> expected, actual;
+    draw("reference/" + vertexFile, "reference/" + fragmentFile, key, expected);
+    draw(vertexFile, fragmentFile, key, actual);
+    int worst = 0;
+    size_t differ = 0, lit = 0;
+    for(size_t i = 0; i < expected.size( ); i++){
+      int d = abs(int(expected[i]) - int(actual[i]));
+      worst = d > worst ? d : worst;
+      differ += d > 0;
+    }
+    // Alpha is 1 wherever the clear color is, so only RGB counts
+    for(size_t i = 0; i < expected.size( ); i += 4){
+      lit += expected[i] > 0 || expected[i + 1] > 0 || expected[i + 2] > 0;
+    }
+    bool ok = worst <= TOLERANCE && lit >= MIN_LIT;
+    printf("%s %s and %s, %s: %zu of %zu channels differ, by at most %d/255; %zu pixels lit\n", ok ? "PASS" : "FAIL",
+           vertexFile.c_str( ), fragmentFile.c_str( ), key.describe( ).c_str( ), differ, expected.size( ), worst, lit);
+    passed = passed && ok;
+  }
+
+public:
+  ShaderCheckApp(int argc, char* argv[]) :
+    App(argc, argv, "Shader check", SIZE, SIZE), texture(NULL), passed(true){ }
+
+  ~ShaderCheckApp( ){
+    delete texture;
+  }
+
+  bool begin( ){
+    msglError( );
+    texture = new Texture("textures/awesomeface.png");
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+    return !msglError( );
+  }
+
+  bool end( ){
+    return true;
+  }
+
+  // Everything is checked in the first frame.
+  bool render( ){
+    for(unsigned int lights = 0; lights <= ShaderKey::MAX_LIGHTS; lights++){
+      for(int textured = 0; textured < 2; textured++){
+        ShaderKey key(lights, textured != 0);
+        compare("blinn_phong.vert.glsl", "blinn_phong.frag.glsl", key);
+        if(GLEW_VERSION_3_3){
+          compare("blinn_phong_330.vert.glsl", "blinn_phong_330.frag.glsl", key);
+        }
+      }
+    }
+    if(!GLEW_VERSION_3_3){
+      printf("No OpenGL 3.3; the GLSL 3.30 shaders were not checked.\n");
+    }
+    windowShouldClose( );
+    return passed && !msglError( );
+  }
+};
+
+int main(int argc, char* argv[]){
+  ShaderCheckApp app(argc, argv);
+  return app();
+}
@@ -7,6 +7,7 @@
 //
 
 #include <cmath>
+#include <chrono>
 
 #include "utilities.h"
 
@@ -17,3 +18,7 @@ float deg2rad(float degrees){
 float rad2deg(float radians){
   return radians * (180.0 / M_PI);
 }
+
+double seconds( ){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now( ).time_since_epoch( )).count( );
+}
@@ -13,4 +13,8 @@ float deg2rad(float degrees);
 
 float rad2deg(float radians);
 
+// Seconds on a monotonic clock from an arbitrary start, for timing
+// with or without a window system.
+double seconds( );
+
 #endif